@@ -0,0 +1,744 @@
+// Nearest neighbour and analogy queries over the vectors exported by word2vec.c
+//
+// gcc sem2vec-query.c -o sem2vec-query -lm -pthread -O3 -march=native
+// ./sem2vec-query -model vectors.txt -index vectors.ivf -k 10 -nprobe 16 < queries.txt
+// ./sem2vec-query -model vectors.txt -index vectors.ivf -eval 1000
+// ./sem2vec-query -pq vectors.pq -k 10 < queries.txt
+//
+// The vectors are normalized and grouped into an inverted file (IVF) index: a
+// spherical k-means codebook of `nlist` centroids, each owning the list of vectors
+// closest to it. A query only scans the lists of its `nprobe` closest centroids.
+// The index is saved together with the words and the normalized vectors, so later
+// runs skip both the text parsing and the clustering.
+//
+// With -pq the vectors are the product quantized file written by word2vec -pq-output
+// instead: a word is pq_m one byte codes into per sub-vector codebooks, and a query
+// scans all the codes with the asymmetric distance. Given -model as well, -eval
+// measures that against the exact fp32 vectors.
+//
+// Every line read from stdin is a query: one word asks for its nearest neighbours,
+// three words `a b c` ask for the words closest to b - a + c.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef __SSE__
+#include <immintrin.h>
+#endif
+
+#define MAX_STRING 100
+#define MAX_LINE 1000
+#define MAX_K 1000
+#define QUERY_BATCH 256
+#define KMEANS_ITER 10
+#define KMEANS_SAMPLE 256 // training points per centroid
+#define PQ_BLOCK 8 // words whose codes are scored together, one per lane of an AVX register
+
+typedef float real;
+
+char model_file[MAX_STRING], index_file[MAX_STRING], pq_file[MAX_STRING];
+int sememe = 0, num_threads = 12, k = 10, nprobe = 16, debug_mode = 2;
+long long nlist = 0, eval_queries = 0;
+unsigned long long next_random = 19960322;
+
+long long size = 0, dim = 0; // number of indexed vectors and their dimension
+char *words; // the names of the vectors one after the other, each with its terminating 0
+long long *word_offset; // the name of vector a starts at words[word_offset[a]]
+long long words_size, words_max_size; // bytes used and allocated in `words`
+real *vec; // the normalized vectors (size * dim)
+real *centroid; // the IVF codebook (nlist * dim)
+long long *list_start; // vectors of list c are list_ids[list_start[c] .. list_start[c + 1])
+long long *list_ids;
+long long *assign; // closest centroid of every vector
+long long pq_m, pq_ksub, pq_dsub; // codes per word, centroids per codebook, floats per sub-vector
+real *pq_codebook; // pq_m codebooks of pq_ksub centroids (pq_m * pq_ksub * pq_dsub)
+unsigned char *pq_codes; // blocks of PQ_BLOCK words, each holding their first codes, then their second codes...
+long long word_hash_size;
+long long *word_hash; // open addressing over `words`, -1 marks an empty slot
+
+struct query {
+	char line[MAX_LINE];
+	long long in[3]; // the query words, -1 if unknown
+	int in_num;
+	long long best[MAX_K];
+	real bestd[MAX_K];
+};
+
+struct query *queries;
+long long query_num;
+
+real Dot(const real *a, const real *b, long long l) {
+	long long i = 0;
+	real dot = 0;
+#ifdef __AVX__
+	__m256 acc = _mm256_setzero_ps();
+	for (; i + 8 <= l; i += 8)
+#ifdef __FMA__
+		acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+#else
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+#endif
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	dot = _mm_cvtss_f32(sum);
+#elif defined(__SSE__)
+	__m128 acc = _mm_setzero_ps();
+	for (; i + 4 <= l; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	dot = _mm_cvtss_f32(acc);
+#endif
+	for (; i < l; ++i) dot += a[i] * b[i];
+	return dot;
+}
+
+void Normalize(real *a, long long l) {
+	long long i;
+	real len = sqrt(Dot(a, a, l));
+	if (len == 0) return;
+	for (i = 0; i < l; ++i) a[i] /= len;
+}
+
+double Now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the name of vector a
+char *Word(long long a) {
+	return &words[word_offset[a]];
+}
+
+// Appends the name of vector a to `words`
+void AddWord(long long a, const char *word) {
+	long long length = strlen(word) + 1;
+	if (words_size + length > words_max_size) {
+		words_max_size = 2 * words_max_size + length;
+		words = (char *)realloc(words, words_max_size * sizeof(char));
+	}
+	memcpy(&words[words_size], word, length);
+	word_offset[a] = words_size;
+	words_size += length;
+}
+
+// Returns hash value of a word
+long long GetWordHash(char *word) {
+	unsigned long long hash = 0;
+	for (; *word; ++word) hash = hash * 257 + *word;
+	return hash % word_hash_size;
+}
+
+void BuildWordHash() {
+	long long a, hash;
+	word_hash_size = 2 * size + 1;
+	word_hash = (long long *)malloc(word_hash_size * sizeof(long long));
+	for (a = 0; a < word_hash_size; ++a) word_hash[a] = -1;
+	for (a = 0; a < size; ++a) {
+		hash = GetWordHash(Word(a));
+		while (word_hash[hash] != -1) hash = (hash + 1) % word_hash_size;
+		word_hash[hash] = a;
+	}
+}
+
+// Returns position of a word among the indexed vectors; if the word is not found, returns -1
+long long SearchWord(char *word) {
+	long long hash = GetWordHash(word);
+	while (word_hash[hash] != -1) {
+		if (!strcmp(Word(word_hash[hash]), word)) return word_hash[hash];
+		hash = (hash + 1) % word_hash_size;
+	}
+	return -1;
+}
+
+// Skips the blanks after a vector; returns the first other character
+int SkipBlanks(FILE *fin) {
+	int ch;
+	while ((ch = fgetc(fin)) == ' ');
+	return ch;
+}
+
+// Reads the word vectors, or with -sememe the semantic vectors, of a text model
+void ReadModel() {
+	long long a, b, vocab_size, max_size, semantic_num = -1;
+	int ch;
+	real alpha;
+	char word[MAX_STRING];
+	FILE *fin = fopen(model_file, "rb");
+	if (fin == NULL) {
+		printf("Model file not found\n");
+		exit(1);
+	}
+	if ((fgets(word, MAX_STRING, fin) == NULL) ||
+		(sscanf(word, "%lld %lld %f %lld", &vocab_size, &dim, &alpha, &semantic_num) < 3)) {
+		printf("ERROR: %s is not a text model\n", model_file);
+		exit(1);
+	}
+	max_size = sememe ? (semantic_num >= 0 ? semantic_num + 1 : 1000) : vocab_size;
+	word_offset = (long long *)malloc(max_size * sizeof(long long));
+	vec = (real *)malloc(max_size * dim * sizeof(real));
+	for (a = 0; a < vocab_size; ++a) {
+		fscanf(fin, "%99s ", word);
+		if (sememe) {
+			while (((ch = fgetc(fin)) != '\n') && (ch != EOF));
+			continue;
+		}
+		AddWord(a, word);
+		for (b = 0; b < dim; ++b) fscanf(fin, "%f", &vec[a * dim + b]);
+		SkipBlanks(fin);
+	}
+	size = vocab_size;
+	if (sememe && (semantic_num >= 0)) { // each semantic row starts with its list id
+		for (size = 0; size < semantic_num; ++size) {
+			fscanf(fin, "%99s", word);
+			AddWord(size, word);
+			for (b = 0; b < dim; ++b) fscanf(fin, "%f", &vec[size * dim + b]);
+		}
+	}
+	else if (sememe) {
+		// Older models do not record the number of semantic rows: the rows end with
+		// a new line, the syn1neg matrix that follows is a single line
+		size = 0;
+		while (1) {
+			if (size == max_size) {
+				max_size *= 2;
+				word_offset = (long long *)realloc(word_offset, max_size * sizeof(long long));
+				vec = (real *)realloc(vec, max_size * dim * sizeof(real));
+			}
+			for (b = 0; b < dim; ++b) if (fscanf(fin, "%f", &vec[size * dim + b]) != 1) break;
+			if ((b < dim) || (SkipBlanks(fin) != '\n')) break;
+			sprintf(word, "%lld", size);
+			AddWord(size, word);
+			size++;
+		}
+	}
+	fclose(fin);
+	for (a = 0; a < size; ++a) Normalize(&vec[a * dim], dim);
+	if (debug_mode > 0) printf("Read %lld vectors of size %lld\n", size, dim);
+}
+
+// Loads the product quantized vectors written by word2vec -pq-output. The codes are
+// regrouped into blocks of PQ_BLOCK words for the SIMD scan.
+void ReadQuantized() {
+	long long a, j, n, d, blocks;
+	int ch, b;
+	char magic[8], word[MAX_STRING];
+	unsigned char *code;
+	FILE *fin = fopen(pq_file, "rb");
+	if (fin == NULL) {
+		printf("Quantized model file not found\n");
+		exit(1);
+	}
+	if ((fread(magic, 1, 8, fin) != 8) || strcmp(magic, "S2VPQ1")) {
+		printf("ERROR: %s is not a quantized model\n", pq_file);
+		exit(1);
+	}
+	fread(&n, sizeof(long long), 1, fin);
+	fread(&d, sizeof(long long), 1, fin);
+	fread(&pq_m, sizeof(long long), 1, fin);
+	fread(&pq_ksub, sizeof(long long), 1, fin);
+	if ((vec != NULL) && ((n != size) || (d != dim))) {
+		printf("ERROR: %s does not hold the vectors of %s\n", pq_file, model_file);
+		exit(1);
+	}
+	size = n;
+	dim = d;
+	pq_dsub = dim / pq_m;
+	pq_codebook = (real *)malloc(pq_m * pq_ksub * pq_dsub * sizeof(real));
+	fread(pq_codebook, sizeof(real), pq_m * pq_ksub * pq_dsub, fin);
+	if (vec == NULL) word_offset = (long long *)malloc(size * sizeof(long long));
+	for (a = 0; a < size; ++a) {
+		b = 0;
+		while (((ch = fgetc(fin)) != 0) && (ch != EOF)) if (b < MAX_STRING - 1) word[b++] = ch;
+		word[b] = 0;
+		if (vec == NULL) AddWord(a, word);
+		else if (strcmp(word, Word(a))) {
+			printf("ERROR: word %lld of %s is %s, but %s in %s\n", a, pq_file, word, Word(a), model_file);
+			exit(1);
+		}
+	}
+	blocks = (size + PQ_BLOCK - 1) / PQ_BLOCK;
+	pq_codes = (unsigned char *)calloc(blocks * pq_m * PQ_BLOCK, sizeof(unsigned char));
+	code = (unsigned char *)malloc(pq_m * sizeof(unsigned char));
+	for (a = 0; a < size; ++a) {
+		if (fread(code, 1, pq_m, fin) != (size_t)pq_m) {
+			printf("ERROR: truncated quantized model\n");
+			exit(1);
+		}
+		for (j = 0; j < pq_m; ++j) pq_codes[(a / PQ_BLOCK * pq_m + j) * PQ_BLOCK + a % PQ_BLOCK] = code[j];
+	}
+	free(code);
+	fclose(fin);
+	if (debug_mode > 0) printf("Loaded %lld quantized vectors of size %lld in %lld codes (%lld bytes)\n", size, dim, pq_m,
+		blocks * pq_m * PQ_BLOCK + pq_m * pq_ksub * pq_dsub * (long long)sizeof(real) + words_size + size * (long long)sizeof(long long));
+}
+
+// Adds `scale` times the vector of a word to v; the vector is decoded from its codes
+// when only the quantized vectors are loaded
+void AddWordVector(long long id, real scale, real *v) {
+	long long b, j;
+	real *c;
+	if (vec != NULL) {
+		for (b = 0; b < dim; ++b) v[b] += scale * vec[id * dim + b];
+		return;
+	}
+	for (j = 0; j < pq_m; ++j) {
+		c = &pq_codebook[(j * pq_ksub + pq_codes[(id / PQ_BLOCK * pq_m + j) * PQ_BLOCK + id % PQ_BLOCK]) * pq_dsub];
+		for (b = 0; b < pq_dsub; ++b) v[j * pq_dsub + b] += scale * c[b];
+	}
+}
+
+// Returns the centroid closest to a vector
+long long Closest(real *v) {
+	long long c, best = 0;
+	real d, bestd = -2;
+	for (c = 0; c < nlist; ++c) {
+		d = Dot(v, &centroid[c * dim], dim);
+		if (d > bestd) {
+			bestd = d;
+			best = c;
+		}
+	}
+	return best;
+}
+
+// Runs fun(id) on `num_threads` threads, each striding over the work by `num_threads`
+void Parallel(void *(*fun)(void *)) {
+	long long a;
+	pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+	for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, fun, (void *)a);
+	for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+	free(pt);
+}
+
+long long assign_num; // vectors [0, assign_num) of `assign_ids` are assigned by AssignThread
+long long *assign_ids;
+
+void *AssignThread(void *id) {
+	long long a;
+	for (a = (long long)id; a < assign_num; a += num_threads)
+		assign[a] = Closest(&vec[assign_ids[a] * dim]);
+	pthread_exit(NULL);
+}
+
+// Spherical k-means over a random sample, then assigns every vector to its list
+void BuildIndex() {
+	long long a, b, c, iter, train_num;
+	long long *count;
+	double start = Now();
+	if (nlist == 0) nlist = 4 * (long long)sqrt(size);
+	if (nlist > size) nlist = size;
+	if (nlist < 1) nlist = 1;
+	train_num = nlist * KMEANS_SAMPLE;
+	if (train_num > size) train_num = size;
+	centroid = (real *)malloc(nlist * dim * sizeof(real));
+	count = (long long *)calloc(nlist, sizeof(long long));
+	assign = (long long *)malloc(size * sizeof(long long));
+	assign_ids = (long long *)malloc(size * sizeof(long long));
+	// Partial Fisher-Yates shuffle to draw the training sample
+	for (a = 0; a < size; ++a) assign_ids[a] = a;
+	for (a = 0; a < train_num; ++a) {
+		next_random = next_random * (unsigned long long)25214903917 + 11;
+		b = a + (next_random >> 16) % (size - a);
+		c = assign_ids[a];
+		assign_ids[a] = assign_ids[b];
+		assign_ids[b] = c;
+	}
+	for (c = 0; c < nlist; ++c) memcpy(&centroid[c * dim], &vec[assign_ids[c] * dim], dim * sizeof(real));
+	assign_num = train_num;
+	for (iter = 0; iter < KMEANS_ITER; ++iter) {
+		Parallel(AssignThread);
+		memset(centroid, 0, nlist * dim * sizeof(real));
+		memset(count, 0, nlist * sizeof(long long));
+		for (a = 0; a < train_num; ++a) {
+			c = assign[a];
+			count[c]++;
+			for (b = 0; b < dim; ++b) centroid[c * dim + b] += vec[assign_ids[a] * dim + b];
+		}
+		for (c = 0; c < nlist; ++c) {
+			if (count[c] == 0) { // reseed an empty list with a random training point
+				next_random = next_random * (unsigned long long)25214903917 + 11;
+				a = assign_ids[(next_random >> 16) % train_num];
+				memcpy(&centroid[c * dim], &vec[a * dim], dim * sizeof(real));
+			}
+			Normalize(&centroid[c * dim], dim);
+		}
+		if (debug_mode > 1) {
+			printf("%cK-means iteration %lld/%d", 13, iter + 1, KMEANS_ITER);
+			fflush(stdout);
+		}
+	}
+	for (a = 0; a < size; ++a) assign_ids[a] = a;
+	assign_num = size;
+	Parallel(AssignThread);
+	// Counting sort of the vectors into their lists
+	list_start = (long long *)calloc(nlist + 1, sizeof(long long));
+	list_ids = (long long *)malloc(size * sizeof(long long));
+	for (a = 0; a < size; ++a) list_start[assign[a] + 1]++;
+	for (c = 0; c < nlist; ++c) list_start[c + 1] += list_start[c];
+	memcpy(count, list_start, nlist * sizeof(long long));
+	for (a = 0; a < size; ++a) list_ids[count[assign[a]]++] = a;
+	free(count);
+	free(assign);
+	free(assign_ids);
+	if (debug_mode > 0) printf("\nBuilt %lld lists in %.2fs\n", nlist, Now() - start);
+}
+
+void SaveIndex() {
+	FILE *fo = fopen(index_file, "wb");
+	if (fo == NULL) {
+		printf("Cannot write the index file\n");
+		exit(1);
+	}
+	fwrite("S2VIVF3", 1, 8, fo);
+	fwrite(&sememe, sizeof(int), 1, fo);
+	fwrite(&size, sizeof(long long), 1, fo);
+	fwrite(&dim, sizeof(long long), 1, fo);
+	fwrite(&nlist, sizeof(long long), 1, fo);
+	fwrite(&words_size, sizeof(long long), 1, fo);
+	fwrite(words, sizeof(char), words_size, fo);
+	fwrite(vec, sizeof(real), size * dim, fo);
+	fwrite(centroid, sizeof(real), nlist * dim, fo);
+	fwrite(list_start, sizeof(long long), nlist + 1, fo);
+	fwrite(list_ids, sizeof(long long), size, fo);
+	fclose(fo);
+}
+
+// Returns 1 if the index was loaded, 0 if there is no index file yet or it has to be
+// rebuilt because -model is newer
+int ReadIndex() {
+	long long a, b;
+	int index_sememe;
+	char magic[8];
+	struct stat model_stat, index_stat;
+	FILE *fin = fopen(index_file, "rb");
+	if (fin == NULL) return 0;
+	if ((model_file[0] != 0) && !stat(model_file, &model_stat) && !stat(index_file, &index_stat) &&
+		(model_stat.st_mtime > index_stat.st_mtime)) {
+		printf("%s is newer than the index %s, rebuilding it\n", model_file, index_file);
+		fclose(fin);
+		return 0;
+	}
+	if ((fread(magic, 1, 8, fin) != 8) || strcmp(magic, "S2VIVF3")) {
+		printf("ERROR: %s is not an index file of this version\n", index_file);
+		exit(1);
+	}
+	fread(&index_sememe, sizeof(int), 1, fin);
+	if (index_sememe != sememe) {
+		printf("ERROR: %s indexes the %s vectors, but -sememe %d asks for the %s vectors\n", index_file,
+			index_sememe ? "semantic" : "word", sememe, sememe ? "semantic" : "word");
+		exit(1);
+	}
+	fread(&size, sizeof(long long), 1, fin);
+	fread(&dim, sizeof(long long), 1, fin);
+	fread(&nlist, sizeof(long long), 1, fin);
+	fread(&words_size, sizeof(long long), 1, fin);
+	words_max_size = words_size;
+	words = (char *)malloc(words_size * sizeof(char));
+	word_offset = (long long *)malloc(size * sizeof(long long));
+	vec = (real *)malloc(size * dim * sizeof(real));
+	centroid = (real *)malloc(nlist * dim * sizeof(real));
+	list_start = (long long *)malloc((nlist + 1) * sizeof(long long));
+	list_ids = (long long *)malloc(size * sizeof(long long));
+	fread(words, sizeof(char), words_size, fin);
+	for (a = 0, b = 0; a < size; ++a) { // the names follow each other, each ends with a 0
+		word_offset[a] = b;
+		b += strlen(&words[b]) + 1;
+	}
+	fread(vec, sizeof(real), size * dim, fin);
+	fread(centroid, sizeof(real), nlist * dim, fin);
+	fread(list_start, sizeof(long long), nlist + 1, fin);
+	if (fread(list_ids, sizeof(long long), size, fin) != (size_t)size) {
+		printf("ERROR: truncated index file\n");
+		exit(1);
+	}
+	fclose(fin);
+	if (debug_mode > 0) printf("Loaded %lld vectors of size %lld in %lld lists\n", size, dim, nlist);
+	return 1;
+}
+
+// Keeps best[0 .. n) sorted by decreasing similarity
+void Insert(long long *best, real *bestd, int n, long long id, real d) {
+	int a;
+	if (d <= bestd[n - 1]) return;
+	for (a = n - 1; (a > 0) && (bestd[a - 1] < d); --a) {
+		bestd[a] = bestd[a - 1];
+		best[a] = best[a - 1];
+	}
+	bestd[a] = d;
+	best[a] = id;
+}
+
+int Excluded(struct query *q, long long id) {
+	int a;
+	for (a = 0; a < q->in_num; ++a) if (q->in[a] == id) return 1;
+	return 0;
+}
+
+void Reset(struct query *q) {
+	int a;
+	for (a = 0; a < k; ++a) {
+		q->best[a] = -1;
+		q->bestd[a] = -2;
+	}
+}
+
+// Exhaustive search, the reference for the recall
+void SearchExact(struct query *q, real *v) {
+	long long a;
+	Reset(q);
+	for (a = 0; a < size; ++a) if (!Excluded(q, a)) Insert(q->best, q->bestd, k, a, Dot(v, &vec[a * dim], dim));
+}
+
+// Scans the lists of the `nprobe` centroids closest to the query
+void SearchIndex(struct query *q, real *v) {
+	long long a, c, id, probe[MAX_K];
+	real probed[MAX_K];
+	int p, probe_num = nprobe < nlist ? nprobe : nlist;
+	for (p = 0; p < probe_num; ++p) probed[p] = -2;
+	for (c = 0; c < nlist; ++c) Insert(probe, probed, probe_num, c, Dot(v, &centroid[c * dim], dim));
+	Reset(q);
+	for (p = 0; p < probe_num; ++p) {
+		c = probe[p];
+		for (a = list_start[c]; a < list_start[c + 1]; ++a) {
+			id = list_ids[a];
+			if (!Excluded(q, id)) Insert(q->best, q->bestd, k, id, Dot(v, &vec[id * dim], dim));
+		}
+	}
+}
+
+// Scans all the codes with the asymmetric distance: the dot products of the query with
+// every centroid are tabulated in `lut`, then a word scores the sum of its pq_m entries
+void SearchQuantized(struct query *q, real *v, real *lut) {
+	long long a, c, j, block, blocks = (size + PQ_BLOCK - 1) / PQ_BLOCK;
+	real score[PQ_BLOCK];
+	unsigned char *code;
+	int b;
+	for (j = 0; j < pq_m; ++j) for (c = 0; c < pq_ksub; ++c)
+		lut[j * pq_ksub + c] = Dot(&v[j * pq_dsub], &pq_codebook[(j * pq_ksub + c) * pq_dsub], pq_dsub);
+	Reset(q);
+	for (block = 0; block < blocks; ++block) {
+		code = &pq_codes[block * pq_m * PQ_BLOCK];
+#ifdef __AVX2__
+		__m256 acc = _mm256_setzero_ps();
+		for (j = 0; j < pq_m; ++j) {
+			__m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&code[j * PQ_BLOCK]));
+			acc = _mm256_add_ps(acc, _mm256_i32gather_ps(&lut[j * pq_ksub], idx, 4));
+		}
+		_mm256_storeu_ps(score, acc);
+#else
+		for (b = 0; b < PQ_BLOCK; ++b) score[b] = 0;
+		for (j = 0; j < pq_m; ++j)
+			for (b = 0; b < PQ_BLOCK; ++b) score[b] += lut[j * pq_ksub + code[j * PQ_BLOCK + b]];
+#endif
+		for (b = 0; b < PQ_BLOCK; ++b) {
+			a = block * PQ_BLOCK + b;
+			if ((a < size) && !Excluded(q, a)) Insert(q->best, q->bestd, k, a, score[b]);
+		}
+	}
+}
+
+// Searches the quantized vectors when they are loaded, the IVF index otherwise
+void Search(struct query *q, real *v, real *lut) {
+	if (pq_codes != NULL) SearchQuantized(q, v, lut);
+	else SearchIndex(q, v);
+}
+
+// Parses the query words and builds the query vector; returns 0 if a word is unknown
+int QueryVector(struct query *q, real *v) {
+	char word[MAX_LINE];
+	char *pos = q->line;
+	int n;
+	q->in_num = 0;
+	while ((q->in_num < 3) && (sscanf(pos, "%s%n", word, &n) == 1)) {
+		q->in[q->in_num] = SearchWord(word);
+		if (q->in[q->in_num++] == -1) return 0;
+		pos += n;
+	}
+	if ((q->in_num == 0) || (q->in_num == 2)) return 0;
+	memset(v, 0, dim * sizeof(real));
+	if (q->in_num == 1) {
+		AddWordVector(q->in[0], 1, v);
+		return 1;
+	}
+	AddWordVector(q->in[1], 1, v);
+	AddWordVector(q->in[0], -1, v);
+	AddWordVector(q->in[2], 1, v);
+	Normalize(v, dim);
+	return 1;
+}
+
+void *QueryThread(void *id) {
+	long long a;
+	real *v = (real *)malloc(dim * sizeof(real));
+	real *lut = (real *)malloc(pq_m * pq_ksub * sizeof(real));
+	for (a = (long long)id; a < query_num; a += num_threads) {
+		if (QueryVector(&queries[a], v)) Search(&queries[a], v, lut);
+		else queries[a].in_num = 0;
+	}
+	free(v);
+	free(lut);
+	pthread_exit(NULL);
+}
+
+// Answers the queries read from stdin, QUERY_BATCH lines at a time
+void Serve() {
+	long long a;
+	int b;
+	char *end;
+	while (1) {
+		for (query_num = 0; query_num < QUERY_BATCH; ++query_num) {
+			if (fgets(queries[query_num].line, MAX_LINE, stdin) == NULL) break;
+			if ((end = strchr(queries[query_num].line, '\n')) != NULL) *end = 0;
+		}
+		if (query_num == 0) break;
+		Parallel(QueryThread);
+		for (a = 0; a < query_num; ++a) {
+			printf("%s\n", queries[a].line);
+			if (queries[a].in_num == 0) printf("\tout of dictionary word or malformed query\n");
+			else for (b = 0; b < k; ++b) if (queries[a].best[b] != -1)
+				printf("\t%s\t%f\n", Word(queries[a].best[b]), queries[a].bestd[b]);
+		}
+		fflush(stdout);
+	}
+}
+
+int CompareReal(const void *a, const void *b) {
+	real d = *(real *)a - *(real *)b;
+	return (d > 0) - (d < 0);
+}
+
+void PrintLatency(const char *name, real *t, long long n) {
+	qsort(t, n, sizeof(real), CompareReal);
+	printf("%s latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", name,
+		t[n / 2] * 1e3, t[n * 9 / 10] * 1e3, t[n * 99 / 100] * 1e3, t[n - 1] * 1e3);
+}
+
+// Measures recall@k of the index, or of the quantized vectors, against exhaustive
+// search on random vectors of the index
+void Evaluate() {
+	long long a, found = 0, id;
+	int b, c;
+	double t;
+	struct query exact, approx;
+	real *lut = (real *)malloc(pq_m * pq_ksub * sizeof(real));
+	real *exact_time = (real *)malloc(eval_queries * sizeof(real));
+	real *approx_time = (real *)malloc(eval_queries * sizeof(real));
+	for (a = 0; a < eval_queries; ++a) {
+		next_random = next_random * (unsigned long long)25214903917 + 11;
+		id = (next_random >> 16) % size;
+		exact.in[0] = approx.in[0] = id;
+		exact.in_num = approx.in_num = 1;
+		t = Now();
+		SearchExact(&exact, &vec[id * dim]);
+		exact_time[a] = Now() - t;
+		t = Now();
+		Search(&approx, &vec[id * dim], lut);
+		approx_time[a] = Now() - t;
+		for (b = 0; b < k; ++b) for (c = 0; c < k; ++c)
+			if ((exact.best[b] != -1) && (exact.best[b] == approx.best[c])) found++;
+	}
+	if (pq_codes != NULL) printf("Recall@%d of %lld codes against fp32: %.4f\n", k, pq_m, found / (double)(eval_queries * k));
+	else printf("Recall@%d with nprobe %d of %lld lists: %.4f\n", k, nprobe, nlist, found / (double)(eval_queries * k));
+	PrintLatency("Exact", exact_time, eval_queries);
+	PrintLatency(pq_codes != NULL ? "Quantized" : "Index", approx_time, eval_queries);
+	free(lut);
+	free(exact_time);
+	free(approx_time);
+}
+
+int ArgPos(char *str, int argc, char **argv) {
+	int a;
+	for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
+		if (a == argc - 1) {
+			printf("Argument missing for %s\n", str);
+			exit(1);
+		}
+		return a;
+	}
+	return -1;
+}
+
+int main(int argc, char **argv) {
+	int i;
+	if (argc == 1) {
+		printf("Nearest neighbour queries over sem2vec vectors\n\n");
+		printf("Options:\n");
+		printf("\t-model <file>\n");
+		printf("\t\tRead the vectors from the text model <file> written by word2vec\n");
+		printf("\t-index <file>\n");
+		printf("\t\tLoad the index from <file>, or build it from -model and save it there; rebuilt when -model is newer\n");
+		printf("\t-pq <file>\n");
+		printf("\t\tSearch the quantized vectors of <file> written by word2vec -pq-output; with -model, -eval compares them to fp32\n");
+		printf("\t-sememe <int>\n");
+		printf("\t\tIndex the semantic vectors instead of the word vectors; default is 0 (off)\n");
+		printf("\t-nlist <int>\n");
+		printf("\t\tNumber of inverted lists; default is 4 * sqrt(number of vectors)\n");
+		printf("\t-nprobe <int>\n");
+		printf("\t\tNumber of lists scanned per query; default is 16\n");
+		printf("\t-k <int>\n");
+		printf("\t\tNumber of neighbours returned; default is 10\n");
+		printf("\t-threads <int>\n");
+		printf("\t\tUse <int> threads (default 12)\n");
+		printf("\t-eval <int>\n");
+		printf("\t\tReport recall and latency against exact search on <int> random queries instead of reading stdin\n");
+		printf("\t-debug <int>\n");
+		printf("\t\tSet the debug mode (default = 2 = more info)\n");
+		printf("\nExamples:\n");
+		printf("./sem2vec-query -model vec.txt -index vec.ivf -k 10 -nprobe 16 < queries.txt\n");
+		printf("./sem2vec-query -model vec.txt -pq vec.pq -eval 1000\n\n");
+		return 0;
+	}
+	model_file[0] = 0;
+	index_file[0] = 0;
+	pq_file[0] = 0;
+	if ((i = ArgPos((char *)"-model", argc, argv)) > 0) strcpy(model_file, argv[i + 1]);
+	if ((i = ArgPos((char *)"-index", argc, argv)) > 0) strcpy(index_file, argv[i + 1]);
+	if ((i = ArgPos((char *)"-pq", argc, argv)) > 0) strcpy(pq_file, argv[i + 1]);
+	if ((i = ArgPos((char *)"-sememe", argc, argv)) > 0) sememe = atoi(argv[i + 1]) != 0;
+	if ((i = ArgPos((char *)"-nlist", argc, argv)) > 0) nlist = atoll(argv[i + 1]);
+	if ((i = ArgPos((char *)"-nprobe", argc, argv)) > 0) nprobe = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-k", argc, argv)) > 0) k = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-eval", argc, argv)) > 0) eval_queries = atoll(argv[i + 1]);
+	if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
+	if ((k < 1) || (k > MAX_K) || (nprobe < 1) || (nprobe > MAX_K)) {
+		printf("ERROR: -k and -nprobe must be between 1 and %d\n", MAX_K);
+		exit(1);
+	}
+	if (pq_file[0] != 0) {
+		if (sememe) {
+			printf("ERROR: the quantized model holds the word vectors only\n");
+			exit(1);
+		}
+		if (model_file[0] != 0) ReadModel(); // the fp32 reference of -eval
+		else if (eval_queries > 0) {
+			printf("ERROR: -eval of -pq needs the fp32 vectors of -model\n");
+			exit(1);
+		}
+		ReadQuantized();
+	}
+	else if ((index_file[0] == 0) || !ReadIndex()) {
+		if (model_file[0] == 0) {
+			printf("ERROR: either -model or an existing -index is required\n");
+			exit(1);
+		}
+		ReadModel();
+		BuildIndex();
+		if (index_file[0] != 0) SaveIndex();
+	}
+	BuildWordHash();
+	if (eval_queries > 0) {
+		Evaluate();
+		return 0;
+	}
+	queries = (struct query *)malloc(QUERY_BATCH * sizeof(struct query));
+	Serve();
+	return 0;
+}
@@ -0,0 +1,1121 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sem2vec.h"
+
+#define MAX_STRING SEM2VEC_MAX_STRING
+#define EXP_TABLE_SIZE 1000
+#define MAX_EXP 6
+#define MAX_SENTENCE_LENGTH 1000
+#define MAX_CODE_LENGTH 40
+
+typedef sem2vec_real real;
+
+// A slot of an open addressing hash table: the cached hash value of the key
+// avoids comparing keys whose hashes differ, id is -1 for an empty slot
+struct sem2vec_hash_slot {
+	unsigned int hash;
+	int id;
+};
+
+static const long long vocab_reduce_size = 7000000;  // Sem2vecLearnVocab prunes rare words beyond 7M words
+static const long long min_hash_size = 1024;
+static const long long legacy_semantic_num = 450000; // semantic rows of models saved without their list ids
+static const int table_size = 1e8;
+
+static real vectorDot(real *a, real *b, int l) {
+	int i;
+	real dot = 0;
+	for (i = 0; i < l; ++i)
+		dot += a[i] * b[i];
+	return dot;
+}
+
+static struct sem2vec_hash_slot *HashCreate(long long size) {
+	long long a;
+	struct sem2vec_hash_slot *table = (struct sem2vec_hash_slot *)malloc(size * sizeof(struct sem2vec_hash_slot));
+	for (a = 0; a < size; a++) table[a].id = -1;
+	return table;
+}
+
+static void HashInsert(struct sem2vec_hash_slot *table, long long size, unsigned int hash, int id) {
+	long long pos = hash & (size - 1);
+	while (table[pos].id != -1) pos = (pos + 1) & (size - 1);
+	table[pos].hash = hash;
+	table[pos].id = id;
+}
+
+// Doubles the table once `num` keys would fill it over half; keys are moved by their cached hash
+static void HashReserve(struct sem2vec_hash_slot **table, long long *size, long long num) {
+	long long a, old_size = *size;
+	struct sem2vec_hash_slot *old_table = *table;
+	if (num * 2 <= old_size) return;
+	while (num * 2 > *size) *size *= 2;
+	*table = HashCreate(*size);
+	for (a = 0; a < old_size; a++)
+		if (old_table[a].id != -1) HashInsert(*table, *size, old_table[a].hash, old_table[a].id);
+	free(old_table);
+}
+
+struct sem2vec *Sem2vecCreate(void) {
+	long long a;
+	struct sem2vec *s = (struct sem2vec *)calloc(1, sizeof(struct sem2vec));
+	s->layer1_size = 100;
+	s->iter = 5;
+	s->window = 5;
+	s->negative = 5;
+	s->min_count = 5;
+	s->debug_mode = 2;
+	s->alpha = 0.025;
+	s->sample = 1e-3;
+	s->min_reduce = 1;
+	// Birthday of an important girl.
+	// Thanks to such a fortunate random seed, I get the satisfying results.
+	s->next_random = 19960322;
+	s->vocab_max_size = 1000;
+	s->vocab = (struct sem2vec_vocab_word *)calloc(s->vocab_max_size, sizeof(struct sem2vec_vocab_word));
+	s->vocab_hash_size = min_hash_size;
+	s->vocab_hash = HashCreate(s->vocab_hash_size);
+	s->sememe_max_size = 1000;
+	s->sememe_id = (int *)malloc(s->sememe_max_size * sizeof(int));
+	s->sememe_hash_size = min_hash_size;
+	s->sememe_hash = HashCreate(s->sememe_hash_size);
+	s->composite_max_size = 1000;
+	s->composite_list_num = (int *)malloc(s->composite_max_size * sizeof(int));
+	s->composite_in_list = (int **)malloc(s->composite_max_size * sizeof(int *));
+	s->composite_hash_size = min_hash_size;
+	s->composite_hash = HashCreate(s->composite_hash_size);
+	s->expTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
+	for (a = 0; a < EXP_TABLE_SIZE; a++) {
+		s->expTable[a] = exp((a / (real)EXP_TABLE_SIZE * 2 - 1) * MAX_EXP); // Precompute the exp() table
+		s->expTable[a] = s->expTable[a] / (s->expTable[a] + 1);                   // Precompute f(x) = x / (x + 1)
+	}
+	return s;
+}
+
+void Sem2vecFree(struct sem2vec *s) {
+	long long a;
+	for (a = 0; a < s->vocab_size; a++) {
+		free(s->vocab[a].word);
+		free(s->vocab[a].code);
+		free(s->vocab[a].point);
+	}
+	for (a = 0; a < s->composite_num; a++) free(s->composite_in_list[a]);
+	free(s->vocab);
+	free(s->vocab_hash);
+	free(s->sememe_id);
+	free(s->sememe_hash);
+	free(s->composite_list_num);
+	free(s->composite_in_list);
+	free(s->composite_hash);
+	free(s->expTable);
+	free(s->syn0);
+	free(s->syn_sem);
+	free(s->syn1neg);
+	free(s->table);
+	free(s->eval_word1);
+	free(s->eval_word2);
+	free(s->eval_gold);
+	free(s);
+}
+
+static void InitUnigramTable(struct sem2vec *s) {
+	int a, i;
+	double train_words_pow = 0;
+	double d1, power = 0.75;
+	s->table = (int *)malloc(table_size * sizeof(int));
+	for (a = 0; a < s->vocab_size; a++) train_words_pow += pow(s->vocab[a].cn, power);
+	i = 0;
+	d1 = pow(s->vocab[i].cn, power) / train_words_pow;
+	for (a = 0; a < table_size; a++) {
+		s->table[a] = i;
+		if (a / (double)table_size > d1) {
+			i++;
+			d1 += pow(s->vocab[i].cn, power) / train_words_pow;
+		}
+		if (i >= s->vocab_size) i = s->vocab_size - 1;
+	}
+}
+
+// Reads a single word from a file, assuming space + tab + EOL to be word boundaries
+void Sem2vecReadWord(char *word, FILE *fin) {
+	int a = 0, ch;
+	while (!feof(fin)) {
+		ch = fgetc(fin);
+		if (ch == 13) continue;
+		if ((ch == ' ') || (ch == '\t') || (ch == '\n')) {
+			if (a > 0) {
+				if (ch == '\n') ungetc(ch, fin);
+				break;
+			}
+			if (ch == '\n') {
+				strcpy(word, (char *)"</s>");
+				return;
+			}
+			else continue;
+		}
+		word[a] = ch;
+		a++;
+		if (a >= MAX_STRING - 1) a--;   // Truncate too long words
+	}
+	word[a] = 0;
+}
+
+// Returns hash value of a word (64 bit FNV-1a folded to 32 bits)
+static unsigned int GetWordHash(const char *word) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (; *word; word++) hash = (hash ^ (unsigned char)*word) * 1099511628211ULL;
+	return hash ^ (hash >> 32);
+}
+
+// Returns position of a word in the vocabulary; if the word is not found, returns -1
+long long Sem2vecSearchWord(struct sem2vec *s, const char *word) {
+	unsigned int hash = GetWordHash(word);
+	long long mask = s->vocab_hash_size - 1, pos = hash & mask;
+	struct sem2vec_hash_slot *slot;
+	while (1) {
+		slot = &s->vocab_hash[pos];
+		if (slot->id == -1) return -1;
+		if ((slot->hash == hash) && !strcmp(word, s->vocab[slot->id].word)) return slot->id;
+		pos = (pos + 1) & mask;
+	}
+	return -1;
+}
+
+// Sizes the hash table for the current vocabulary and fills it from the cached hashes
+static void RebuildVocabHash(struct sem2vec *s) {
+	long long a;
+	free(s->vocab_hash);
+	s->vocab_hash_size = min_hash_size;
+	while (s->vocab_size * 2 > s->vocab_hash_size) s->vocab_hash_size *= 2;
+	s->vocab_hash = HashCreate(s->vocab_hash_size);
+	for (a = 0; a < s->vocab_size; a++) HashInsert(s->vocab_hash, s->vocab_hash_size, s->vocab[a].hash, a);
+}
+
+// Reads a word and returns its index in the vocabulary
+long long Sem2vecReadWordIndex(struct sem2vec *s, FILE *fin) {
+	char word[MAX_STRING];
+	Sem2vecReadWord(word, fin);
+	if (feof(fin)) return -1;
+	return Sem2vecSearchWord(s, word);
+}
+
+// Adds a word to the vocabulary
+long long Sem2vecAddWord(struct sem2vec *s, const char *word, long long cn) {
+	unsigned int length = strlen(word) + 1;
+	struct sem2vec_vocab_word *v;
+	if (length > MAX_STRING) length = MAX_STRING;
+	// Reallocate memory if needed
+	if (s->vocab_size + 2 >= s->vocab_max_size) {
+		s->vocab_max_size = 2 * s->vocab_max_size + 2;
+		s->vocab = (struct sem2vec_vocab_word *)realloc(s->vocab, s->vocab_max_size * sizeof(struct sem2vec_vocab_word));
+	}
+	v = &s->vocab[s->vocab_size];
+	v->word = (char *)calloc(length, sizeof(char));
+	strncpy(v->word, word, length - 1);
+	v->cn = cn;
+	v->point = NULL;
+	v->code = NULL;
+	v->list_num = 0;
+	v->in_list = NULL;
+	v->composite = -1;
+	v->hash = GetWordHash(v->word);
+	s->vocab_size++;
+	HashReserve(&s->vocab_hash, &s->vocab_hash_size, s->vocab_size);
+	HashInsert(s->vocab_hash, s->vocab_hash_size, v->hash, s->vocab_size - 1);
+	return s->vocab_size - 1;
+}
+
+// Used later for sorting by word counts
+static int VocabCompare(const void *a, const void *b) {
+	long long ca = ((struct sem2vec_vocab_word *)a)->cn, cb = ((struct sem2vec_vocab_word *)b)->cn;
+	return (cb > ca) - (cb < ca);
+}
+
+// Sorts the vocabulary by frequency using word counts
+void Sem2vecSortVocab(struct sem2vec *s) {
+	int a, b = 0;
+	struct sem2vec_vocab_word *vocab = s->vocab;
+	// Sort the vocabulary and keep </s> at the first position
+	if (s->vocab_size > 1) qsort(&vocab[1], s->vocab_size - 1, sizeof(struct sem2vec_vocab_word), VocabCompare);
+	s->train_words = 0;
+	for (a = 0; a < s->vocab_size; a++) {
+		// Words occuring less than min_count times will be discarded from the vocab
+		if ((vocab[a].cn < s->min_count) && (a != 0)) free(vocab[a].word);
+		else s->train_words += vocab[b++].cn;
+	}
+	s->vocab_size = b;
+	s->vocab = vocab = (struct sem2vec_vocab_word *)realloc(vocab, (s->vocab_size + 1) * sizeof(struct sem2vec_vocab_word));
+	s->vocab_max_size = s->vocab_size + 1;
+	// Hash table will be rebuilt, as after the sorting it is not actual
+	RebuildVocabHash(s);
+	// Allocate memory for the binary tree construction
+	for (a = 0; a < s->vocab_size; a++) {
+		vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
+		vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
+	}
+}
+
+// Reduces the vocabulary by removing infrequent tokens
+static void ReduceVocab(struct sem2vec *s) {
+	int a, b = 0;
+	struct sem2vec_vocab_word *vocab = s->vocab;
+	for (a = 0; a < s->vocab_size; a++)
+		if (vocab[a].cn > s->min_reduce) {
+			vocab[b].cn = vocab[a].cn;
+			vocab[b].word = vocab[a].word;
+			vocab[b].hash = vocab[a].hash;
+			b++;
+		}
+		else free(vocab[a].word);
+	s->vocab_size = b;
+	// Hash table will be rebuilt, as it is not actual
+	RebuildVocabHash(s);
+	fflush(stdout);
+	s->min_reduce++;
+}
+
+// Create binary Huffman tree using the word counts
+// Frequent words will have short uniqe binary codes
+// Unused until hierarchical softmax is trained again
+static void __attribute__((unused)) CreateBinaryTree(struct sem2vec *s) {
+	long long a, b, i, min1i, min2i, pos1, pos2, point[MAX_CODE_LENGTH];
+	long long vocab_size = s->vocab_size;
+	char code[MAX_CODE_LENGTH];
+	long long *count = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+	long long *binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+	long long *parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+	struct sem2vec_vocab_word *vocab = s->vocab;
+	for (a = 0; a < vocab_size; a++) count[a] = vocab[a].cn;
+	for (a = vocab_size; a < vocab_size * 2; a++) count[a] = 1e15;
+	pos1 = vocab_size - 1;
+	pos2 = vocab_size;
+	// Following algorithm constructs the Huffman tree by adding one node at a time
+	for (a = 0; a < vocab_size - 1; a++) {
+		// First, find two smallest nodes 'min1, min2'
+		if (pos1 >= 0) {
+			if (count[pos1] < count[pos2]) {
+				min1i = pos1;
+				pos1--;
+			}
+			else {
+				min1i = pos2;
+				pos2++;
+			}
+		}
+		else {
+			min1i = pos2;
+			pos2++;
+		}
+		if (pos1 >= 0) {
+			if (count[pos1] < count[pos2]) {
+				min2i = pos1;
+				pos1--;
+			}
+			else {
+				min2i = pos2;
+				pos2++;
+			}
+		}
+		else {
+			min2i = pos2;
+			pos2++;
+		}
+		count[vocab_size + a] = count[min1i] + count[min2i];
+		parent_node[min1i] = vocab_size + a;
+		parent_node[min2i] = vocab_size + a;
+		binary[min2i] = 1;
+	}
+	// Now assign binary code to each vocabulary word
+	for (a = 0; a < vocab_size; a++) {
+		b = a;
+		i = 0;
+		while (1) {
+			code[i] = binary[b];
+			point[i] = b;
+			i++;
+			b = parent_node[b];
+			if (b == vocab_size * 2 - 2) break;
+		}
+		vocab[a].codelen = i;
+		vocab[a].point[0] = vocab_size - 2;
+		for (b = 0; b < i; b++) {
+			vocab[a].code[i - b - 1] = code[b];
+			vocab[a].point[i - b] = point[b] - vocab_size;
+		}
+	}
+	free(count);
+	free(binary);
+	free(parent_node);
+}
+
+// Builds the vocabulary from a training file; returns the size of the file
+long long Sem2vecLearnVocab(struct sem2vec *s, const char *file) {
+	char word[MAX_STRING];
+	FILE *fin;
+	long long i, file_size;
+	fin = fopen(file, "rb");
+	if (fin == NULL) {
+		printf("ERROR: training data file not found!\n");
+		exit(1);
+	}
+	s->vocab_size = 0;
+	RebuildVocabHash(s);
+	Sem2vecAddWord(s, (char *)"</s>", 0);
+	while (1) {
+		Sem2vecReadWord(word, fin);
+		if (feof(fin)) break;
+		s->train_words++;
+		if ((s->debug_mode > 1) && (s->train_words % 100000 == 0)) {
+			printf("%lldK%c", s->train_words / 1000, 13);
+			fflush(stdout);
+		}
+		i = Sem2vecSearchWord(s, word);
+		if (i == -1) Sem2vecAddWord(s, word, 1);
+		else s->vocab[i].cn++;
+		if (s->vocab_size > vocab_reduce_size) ReduceVocab(s);
+	}
+	Sem2vecSortVocab(s);
+	if (s->debug_mode > 0) {
+		printf("Vocab size: %lld\n", s->vocab_size);
+		printf("Words in train file: %lld\n", s->train_words);
+	}
+	file_size = ftell(fin);
+	fclose(fin);
+	return file_size;
+}
+
+void Sem2vecSaveVocab(struct sem2vec *s, const char *file) {
+	long long i;
+	FILE *fo = fopen(file, "wb");
+	for (i = 0; i < s->vocab_size; i++) fprintf(fo, "%s %lld\n", s->vocab[i].word, s->vocab[i].cn);
+	fclose(fo);
+}
+
+void Sem2vecReadVocab(struct sem2vec *s, const char *file) {
+	long long cn;
+	char c;
+	char word[MAX_STRING];
+	FILE *fin = fopen(file, "rb");
+	if (fin == NULL) {
+		printf("Vocabulary file not found\n");
+		exit(1);
+	}
+	s->vocab_size = 0;
+	RebuildVocabHash(s);
+	while (1) {
+		Sem2vecReadWord(word, fin);
+		if (feof(fin)) break;
+		fscanf(fin, "%lld%c", &cn, &c);
+		Sem2vecAddWord(s, word, cn);
+	}
+	fclose(fin);
+	Sem2vecSortVocab(s);
+	if (s->debug_mode > 0) {
+		printf("Vocab size: %lld\n", s->vocab_size);
+		printf("Words in train file: %lld\n", s->train_words);
+	}
+}
+
+// Returns hash value of a list id
+static unsigned int GetSememeHash(int id) {
+	return (unsigned int)id * 2654435761u;
+}
+
+// Returns the syn_sem row of a list id, giving it the next row if it is new and `add` is set;
+// returns -1 for a new list id otherwise
+static long long SememeRow(struct sem2vec *s, int id, int add) {
+	unsigned int hash = GetSememeHash(id);
+	long long mask = s->sememe_hash_size - 1, pos = hash & mask, row;
+	while ((row = s->sememe_hash[pos].id) != -1) {
+		if (s->sememe_id[row] == id) return row;
+		pos = (pos + 1) & mask;
+	}
+	if (!add) return -1;
+	if (s->semantic_num == s->sememe_max_size) {
+		s->sememe_max_size *= 2;
+		s->sememe_id = (int *)realloc(s->sememe_id, s->sememe_max_size * sizeof(int));
+	}
+	row = s->semantic_num++;
+	s->sememe_id[row] = id;
+	HashReserve(&s->sememe_hash, &s->sememe_hash_size, s->semantic_num);
+	HashInsert(s->sememe_hash, s->sememe_hash_size, hash, row);
+	return row;
+}
+
+// Reads the header of a saved model; returns its number of semantic rows, or -1 for
+// a model saved before the rows carried their list ids
+static long long ReadModelHeader(FILE *fin, long long *vocab_size, long long *layer1_size, real *alpha) {
+	long long semantic_num;
+	char line[MAX_STRING];
+	if (fgets(line, MAX_STRING, fin) == NULL) {
+		printf("ERROR: the model file is empty\n");
+		exit(1);
+	}
+	if (sscanf(line, "%lld %lld %f %lld", vocab_size, layer1_size, alpha, &semantic_num) == 4) return semantic_num;
+	return -1;
+}
+
+// Loads the semantic rows of a saved model into the rows of the same list ids;
+// rows of list ids that no word has now are skipped
+static void ReadSememeRows(struct sem2vec *s, FILE *fin, long long semantic_num) {
+	long long a, b, row, layer1_size = s->layer1_size;
+	int id, with_ids = semantic_num >= 0;
+	real skip;
+	if (!with_ids) semantic_num = legacy_semantic_num; // row a of those models is list id a
+	for (a = 0; a < semantic_num; ++a) {
+		id = a;
+		if (with_ids) fscanf(fin, "%d", &id);
+		row = SememeRow(s, id, 0);
+		for (b = 0; b < layer1_size; ++b)
+			fscanf(fin, "%f", row == -1 ? &skip : &s->syn_sem[row * layer1_size + b]);
+	}
+}
+
+// restore from a given file(state)
+void Sem2vecReadCheckpoint(struct sem2vec *s, const char *file) {
+	long long a, b, size, dim, semantic_num;
+	FILE *fin = fopen(file, "r");
+	if (fin == NULL) {
+		printf("Checkpoint file not found\n");
+		exit(1);
+	}
+	semantic_num = ReadModelHeader(fin, &size, &dim, &s->alpha);
+	if (size != s->vocab_size) {
+		printf("ERROR: checkpoint has %lld words but the vocabulary has %lld, use -incremental instead\n", size, s->vocab_size);
+		exit(1);
+	}
+	if (dim != s->layer1_size) {
+		printf("ERROR: checkpoint has vector size %lld, expected %lld\n", dim, s->layer1_size);
+		exit(1);
+	}
+	char waste[MAX_STRING];
+	for (a = 0; a < s->vocab_size; ++a) {
+		fscanf(fin, "%s ", waste);
+		for (b = 0; b < s->layer1_size; ++b)
+			fscanf(fin, "%f ", &s->syn0[a * s->layer1_size + b]);
+	}
+	ReadSememeRows(s, fin, semantic_num);
+	for (a = 0; a < s->vocab_size * s->layer1_size; ++a)
+		fscanf(fin, "%f ", &(s->syn1neg[a]));
+	fclose(fin);
+	printf("checkpoint end\n");
+}
+
+// Merges the words of an existing model into the vocabulary.
+// Words that do not occur in the new vocabulary are appended with zero count,
+// so they keep their vectors but are never drawn as negative samples.
+void Sem2vecReadIncrementalVocab(struct sem2vec *s, const char *file) {
+	long long a, i, size, added = 0;
+	int ch;
+	real alpha;
+	char word[MAX_STRING];
+	FILE *fin = fopen(file, "rb");
+	if (fin == NULL) {
+		printf("Incremental model file not found\n");
+		exit(1);
+	}
+	ReadModelHeader(fin, &s->incremental_vocab_size, &size, &alpha);
+	if (size != s->layer1_size) {
+		printf("ERROR: incremental model has vector size %lld, expected %lld\n", size, s->layer1_size);
+		exit(1);
+	}
+	s->incremental_map = (long long *)malloc(s->incremental_vocab_size * sizeof(long long));
+	for (a = 0; a < s->incremental_vocab_size; ++a) {
+		fscanf(fin, "%s ", word);
+		while (((ch = fgetc(fin)) != '\n') && (ch != EOF)); // skip the vector
+		i = Sem2vecSearchWord(s, word);
+		if (i == -1) {
+			i = Sem2vecAddWord(s, word, 0);
+			s->vocab[i].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
+			s->vocab[i].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
+			added++;
+		}
+		s->incremental_map[a] = i;
+	}
+	fclose(fin);
+	if (s->debug_mode > 0) {
+		printf("Incremental model words: %lld\n", s->incremental_vocab_size);
+		printf("Vocab size: %lld (%lld new, %lld only in the model)\n", s->vocab_size,
+			s->vocab_size - s->incremental_vocab_size, added);
+	}
+}
+
+// Loads the vectors of the model given to Sem2vecReadIncrementalVocab into the
+// grown matrices; rows of newly seen words keep their random initialization
+void Sem2vecReadIncremental(struct sem2vec *s, const char *file) {
+	long long a, b, l1, size, dim, semantic_num, layer1_size = s->layer1_size;
+	real alpha;
+	char word[MAX_STRING];
+	FILE *fin = fopen(file, "rb");
+	semantic_num = ReadModelHeader(fin, &size, &dim, &alpha); // checked by Sem2vecReadIncrementalVocab
+	for (a = 0; a < s->incremental_vocab_size; ++a) {
+		fscanf(fin, "%s ", word);
+		l1 = s->incremental_map[a] * layer1_size;
+		for (b = 0; b < layer1_size; ++b)
+			fscanf(fin, "%f ", &s->syn0[l1 + b]);
+	}
+	ReadSememeRows(s, fin, semantic_num);
+	for (a = 0; a < s->incremental_vocab_size; ++a) {
+		l1 = s->incremental_map[a] * layer1_size;
+		for (b = 0; b < layer1_size; ++b)
+			fscanf(fin, "%f ", &s->syn1neg[l1 + b]);
+	}
+	fclose(fin);
+	free(s->incremental_map);
+	s->incremental_map = NULL;
+	printf("incremental model loaded\n");
+}
+
+static int ListCompare(const void *a, const void *b) {
+	return (*(int *)a > *(int *)b) - (*(int *)a < *(int *)b);
+}
+
+// Returns hash value of a sorted list set (64 bit FNV-1a over the ids folded to 32 bits)
+static unsigned int GetListHash(int *list, long long num) {
+	long long a;
+	unsigned long long hash = 14695981039346656037ULL ^ num;
+	for (a = 0; a < num; a++) hash = (hash ^ (unsigned int)list[a]) * 1099511628211ULL;
+	return hash ^ (hash >> 32);
+}
+
+// Returns the composite of a sorted list set, adding it if it is new
+static int SearchComposite(struct sem2vec *s, int *list, long long num) {
+	unsigned int hash = GetListHash(list, num);
+	long long mask = s->composite_hash_size - 1, pos = hash & mask;
+	struct sem2vec_hash_slot *slot;
+	int id;
+	while ((id = (slot = &s->composite_hash[pos])->id) != -1) {
+		if ((slot->hash == hash) && (s->composite_list_num[id] == num) &&
+			!memcmp(s->composite_in_list[id], list, num * sizeof(int))) return id;
+		pos = (pos + 1) & mask;
+	}
+	if (s->composite_num == s->composite_max_size) {
+		s->composite_max_size *= 2;
+		s->composite_list_num = (int *)realloc(s->composite_list_num, s->composite_max_size * sizeof(int));
+		s->composite_in_list = (int **)realloc(s->composite_in_list, s->composite_max_size * sizeof(int *));
+	}
+	id = s->composite_num++;
+	s->composite_list_num[id] = num;
+	s->composite_in_list[id] = (int *)malloc(num * sizeof(int));
+	memcpy(s->composite_in_list[id], list, num * sizeof(int));
+	HashReserve(&s->composite_hash, &s->composite_hash_size, s->composite_num);
+	HashInsert(s->composite_hash, s->composite_hash_size, hash, id);
+	return id;
+}
+
+// Returns the first list id of `lists` that Sem2vecSetLists rejects: a negative one, or
+// once syn_sem is allocated one without a row; returns -1 if all of them are accepted
+static long long BadList(struct sem2vec *s, int *lists, long long num) {
+	long long a;
+	for (a = 0; a < num; a++)
+		if ((lists[a] < 0) || ((s->syn_sem != NULL) && (SememeRow(s, lists[a], 0) == -1))) return a;
+	return -1;
+}
+
+int Sem2vecSetLists(struct sem2vec *s, long long word, int *lists, long long num) {
+	long long a;
+	struct sem2vec_vocab_word *v = &s->vocab[word];
+	if (BadList(s, lists, num) != -1) return -1;
+	for (a = 0; a < num; a++) lists[a] = SememeRow(s, lists[a], 1);
+	if (num == 0) {
+		v->list_num = 0;
+		v->in_list = NULL;
+		v->composite = -1;
+		return 0;
+	}
+	qsort(lists, num, sizeof(int), ListCompare);
+	v->composite = SearchComposite(s, lists, num);
+	v->list_num = num;
+	v->in_list = s->composite_in_list[v->composite];
+	return 0;
+}
+
+void Sem2vecReadProjection(struct sem2vec *s, const char *file)
+{
+	/* This function reads the semantic projections of words
+	** from the file pointed by `file`.
+	** The lists of a word are sorted, so that words with the same
+	** list set share a single composite.
+	*/
+
+	long long a, num, i, words = 0, lists = 0, composite_lists = 0;
+	int bad;
+	char word[MAX_STRING];
+
+	int max_list_contain = 600000; // a word might appear in 600,000 lists
+	int *temp = (int *)malloc(max_list_contain * sizeof(int));
+	FILE *fi = fopen(file, "rb");
+
+	if (fi == NULL)
+	{
+		printf("Semantic file not found!\n");
+		exit(1);
+	}
+
+	num = 0;
+
+	while (1)
+	{
+		Sem2vecReadWord(word, fi);
+
+		if (feof(fi))
+			break;
+
+		num++;
+		if (num % 10000 == 0)
+		{
+			printf("%cHave read %lld0K word semantics", 13, num / 10000);
+			fflush(stdout);
+		}
+
+		fscanf(fi, "%lld", &a);
+		if ((a < 0) || (a > max_list_contain)) {
+			printf("ERROR: word %s has %lld lists, at most %d are supported\n", word, a, max_list_contain);
+			exit(1);
+		}
+		getc(fi); // the white space
+		fread((void *)temp, sizeof(int), a, fi);
+		getc(fi); // the new line
+
+		i = Sem2vecSearchWord(s, word);
+		if ((i == -1) || (a == 0))
+		{
+			continue;
+		}
+
+		if (s->vocab[i].composite == -1) words++;
+		else lists -= s->vocab[i].list_num;
+		if (Sem2vecSetLists(s, i, temp, a) != 0) {
+			bad = temp[BadList(s, temp, a)];
+			if (bad < 0) printf("ERROR: negative list id %d for word %s\n", bad, word);
+			else printf("ERROR: list id %d of word %s has no row in the allocated sememe table\n", bad, word);
+			exit(1);
+		}
+		lists += a;
+	}
+
+	for (a = 0; a < s->composite_num; a++) composite_lists += s->composite_list_num[a];
+	if (s->debug_mode > 0)
+	{
+		printf("\n%lld words with lists share %lld composites (dedup ratio %.2f), %lld of %lld list entries stored\n",
+			words, s->composite_num, words / (real)(s->composite_num + (s->composite_num == 0)), composite_lists, lists);
+		printf("%lld distinct list ids\n", s->semantic_num);
+	}
+
+	free(temp);
+	fclose(fi);
+}
+
+// init some data structures
+void Sem2vecInitNet(struct sem2vec *s) {
+	long long a, b, layer1_size = s->layer1_size;
+	a = posix_memalign((void **)&s->syn0, 128, (long long)s->vocab_size * layer1_size * sizeof(real));
+	if (s->syn0 == NULL)
+	{
+		printf("Memory allocation failed\n");
+		exit(1);
+	}
+
+	a = posix_memalign((void **)&s->syn_sem, 128, (long long)(s->semantic_num + 1) * layer1_size * sizeof(real));
+	if (s->syn_sem == NULL)
+	{
+		printf("Memory allocation failed\n");
+		exit(1);
+	}
+
+	if (s->negative > 0)
+	{
+		a = posix_memalign((void **)&s->syn1neg, 128, (long long)s->vocab_size * layer1_size * sizeof(real));
+		if (s->syn1neg == NULL) { printf("Memory allocation failed\n"); exit(1); }
+		for (a = 0; a < s->vocab_size; a++) for (b = 0; b < layer1_size; b++)
+			s->syn1neg[a * layer1_size + b] = 0;
+	}
+
+	for (a = 0; a < s->vocab_size; ++a)
+		for (b = 0; b < layer1_size; ++b)
+		{
+			s->next_random = s->next_random * (unsigned long long)25214903917 + 11;
+			s->syn0[a * layer1_size + b] = (((s->next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
+		}
+
+	for (a = 0; a < s->semantic_num; ++a)
+		for (b = 0; b < layer1_size; ++b)
+		{
+			s->next_random = s->next_random * (unsigned long long)25214903917 + 11;
+			s->syn_sem[a * layer1_size + b] = (((s->next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
+		}
+	//CreateBinaryTree(s);
+	if (s->negative > 0) InitUnigramTable(s);
+	s->starting_alpha = s->alpha;
+	s->start = clock();
+}
+
+struct sem2vec_worker *Sem2vecCreateWorker(struct sem2vec *s, unsigned long long seed) {
+	struct sem2vec_worker *w = (struct sem2vec_worker *)calloc(1, sizeof(struct sem2vec_worker));
+	w->model = s;
+	w->next_random = seed;
+	w->neu1e = (real *)calloc(s->layer1_size, sizeof(real));
+	w->input_embed = (real *)calloc(s->layer1_size, sizeof(real));
+	return w;
+}
+
+// Fraction of schedule_words, or of iter * train_words, trained so far
+real Sem2vecProgress(struct sem2vec *s) {
+	long long total = s->schedule_words > 0 ? s->schedule_words : s->iter * s->train_words;
+	return s->word_count_actual / (real)(total + 1);
+}
+
+// Adds the words trained since the last update to the shared count and decays alpha
+static void UpdateAlpha(struct sem2vec_worker *w) {
+	struct sem2vec *s = w->model;
+	clock_t now;
+	__sync_fetch_and_add(&s->word_count_actual, w->word_count - w->last_word_count);
+	w->last_word_count = w->word_count;
+	if ((s->debug_mode > 1)) {
+		now = clock();
+		printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, s->alpha,
+			Sem2vecProgress(s) * 100,
+			s->word_count_actual / ((real)(now - s->start + 1) / (real)CLOCKS_PER_SEC * 1000));
+		fflush(stdout);
+	}
+	s->alpha = s->starting_alpha * (1 - Sem2vecProgress(s));
+	if (s->alpha < s->starting_alpha * 0.0001) s->alpha = s->starting_alpha * 0.0001;
+}
+
+void Sem2vecFlushWorker(struct sem2vec_worker *w) {
+	if (w->word_count > w->last_word_count) UpdateAlpha(w);
+}
+
+void Sem2vecFreeWorker(struct sem2vec_worker *w) {
+	Sem2vecFlushWorker(w);
+	free(w->neu1e);
+	free(w->input_embed); // free the preallocated memory
+	free(w);
+}
+
+// Trains skip-gram with negative sampling on one sentence
+static void TrainSentence(struct sem2vec_worker *w, long long *sen, long long sentence_length) {
+	struct sem2vec *s = w->model;
+	long long a, b, d, word, last_word, sentence_position;
+	long long p;
+	long long l1, l2, c, target, label;
+	long long layer1_size = s->layer1_size, window = s->window;
+	real f, g, alpha = s->alpha;
+	real *neu1e = w->neu1e, *input_embed = w->input_embed;
+	real *syn0 = s->syn0, *syn_sem = s->syn_sem, *syn1neg = s->syn1neg;
+	real *input; // the vector of the input word, either its syn0 row or input_embed
+	int local_list_num = 0;
+	int *local_list = NULL;
+
+	for (sentence_position = 0; sentence_position < sentence_length; sentence_position++) {
+		word = sen[sentence_position];
+		w->next_random = w->next_random * (unsigned long long)25214903917 + 11;
+		b = w->next_random % window;
+
+		for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
+			c = sentence_position - window + a;
+			if (c < 0) continue;
+			if (c >= sentence_length) continue;
+			last_word = sen[c];
+			if (last_word == -1) continue;
+			l1 = last_word * layer1_size;
+
+			if (s->vocab[last_word].list_num > 0)
+			{
+				local_list_num = s->vocab[last_word].list_num;
+				local_list = s->vocab[last_word].in_list;
+
+				// calculate the input word embedding in the thread local buffer,
+				// the shared syn0 row is only recomposed once after training
+				for (c = 0; c < layer1_size; ++c)
+					input_embed[c] = 0;
+				for (p = 0; p < local_list_num; ++p)
+				{
+					for (c = 0; c < layer1_size; ++c)
+						input_embed[c] += syn_sem[local_list[p] * layer1_size + c];
+				}
+				for (c = 0; c < layer1_size; ++c)
+					input_embed[c] /= local_list_num;
+				input = input_embed;
+			}
+			else
+				input = &syn0[l1];
+
+			for (c = 0; c < layer1_size; ++c)
+				neu1e[c] = 0;
+
+			// NEGATIVE SAMPLING
+			if (s->negative > 0) for (d = 0; d < s->negative + 1; d++) {
+				if (d == 0) {
+					target = word;
+					label = 1;
+				}
+				else {
+					w->next_random = w->next_random * (unsigned long long)25214903917 + 11;
+					target = s->table[(w->next_random >> 16) % table_size];
+					if (target == 0) target = w->next_random % (s->vocab_size - 1) + 1;
+					if (target == word) continue;
+					label = 0;
+				}
+				l2 = target * layer1_size;
+				f = 0;
+
+				// FP
+				for (c = 0; c < layer1_size; ++c)
+				{
+					f += input[c] * syn1neg[l2 + c];
+				}
+
+				if (f > MAX_EXP)
+					g = (label - 1) * alpha;
+				else if (f < -MAX_EXP)
+					g = (label - 0) * alpha;
+				else
+					g = (label - s->expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
+
+				// accumulate the gradients over negative samples
+				for (c = 0; c < layer1_size; ++c)
+					neu1e[c] += g * syn1neg[c + l2];
+
+				// BP for the output layer
+				for (c = 0; c < layer1_size; ++c)
+					syn1neg[c + l2] += g * input[c];
+			}
+
+			// BP
+			if (s->vocab[last_word].list_num == 0)
+			{
+				// update the word embedding directly
+				for (c = 0; c < layer1_size; ++c)
+					syn0[l1 + c] += neu1e[c];
+			}
+
+			else
+			{
+				// update the sememe embeddings
+				for (c = 0; c < layer1_size; ++c)
+					neu1e[c] /= local_list_num;
+				for (p = 0; p < local_list_num; ++p)
+				{
+					for (c = 0; c < layer1_size; ++c)
+						syn_sem[local_list[p] * layer1_size + c] += neu1e[c];
+				}
+			}
+		}
+	}
+}
+
+void Sem2vecTrainTokens(struct sem2vec_worker *w, const long long *tokens, long long num) {
+	struct sem2vec *s = w->model;
+	long long a, word, sentence_length = 0, sen[MAX_SENTENCE_LENGTH + 1];
+	real ran, threshold = s->sample * s->train_words;
+	for (a = 0; a < num; a++) {
+		word = tokens[a];
+		if (word == -1) continue;
+		w->word_count++;
+		if (s->sample > 0) {
+			ran = (sqrt(s->vocab[word].cn / threshold) + 1) * threshold / s->vocab[word].cn;
+			w->next_random = w->next_random * (unsigned long long)25214903917 + 11;
+			if (ran < (w->next_random & 0xFFFF) / (real)65536) continue;
+		}
+		sen[sentence_length] = word;
+		sentence_length++;
+		if (sentence_length >= MAX_SENTENCE_LENGTH) {
+			TrainSentence(w, sen, sentence_length);
+			sentence_length = 0;
+			if (w->word_count - w->last_word_count > 10000) UpdateAlpha(w); // update alpha and some other params
+		}
+	}
+	if (sentence_length > 0) TrainSentence(w, sen, sentence_length);
+	if (w->word_count - w->last_word_count > 10000) UpdateAlpha(w);
+}
+
+void Sem2vecComposeWord(struct sem2vec *s, long long word, real *vec) {
+	long long b, c, layer1_size = s->layer1_size;
+	struct sem2vec_vocab_word *v = &s->vocab[word];
+	if (v->list_num == 0) {
+		memcpy(vec, &s->syn0[word * layer1_size], layer1_size * sizeof(real));
+		return;
+	}
+	for (c = 0; c < layer1_size; ++c) vec[c] = 0;
+	for (b = 0; b < v->list_num; ++b)
+		for (c = 0; c < layer1_size; ++c)
+			vec[c] += s->syn_sem[v->in_list[b] * layer1_size + c];
+	for (c = 0; c < layer1_size; ++c) vec[c] /= v->list_num;
+}
+
+void Sem2vecCompose(struct sem2vec *s) {
+	long long a, d, layer1_size = s->layer1_size;
+	long long *composite_word; // first word of each composite
+	// compose every composite once into the row of its first word, and copy it to the others
+	composite_word = (long long *)malloc(s->composite_num * sizeof(long long));
+	for (a = 0; a < s->composite_num; ++a)
+		composite_word[a] = -1;
+	for (a = 0; a < s->vocab_size; ++a)
+	{
+		if (s->vocab[a].list_num == 0)
+			continue;
+		d = composite_word[s->vocab[a].composite];
+		if (d != -1)
+		{
+			memcpy(&s->syn0[a * layer1_size], &s->syn0[d * layer1_size], layer1_size * sizeof(real));
+			continue;
+		}
+		composite_word[s->vocab[a].composite] = a;
+		Sem2vecComposeWord(s, a, &s->syn0[a * layer1_size]);
+	}
+	free(composite_word);
+}
+
+// Reads the word pairs of an evaluation file, one "word1 word2 score" per line
+void Sem2vecReadEvalSet(struct sem2vec *s, const char *file) {
+	long long a, b, total = 0, max_num = 1000;
+	char word1[MAX_STRING], word2[MAX_STRING];
+	real score;
+	FILE *fin = fopen(file, "rb");
+	if (fin == NULL) {
+		printf("Evaluation file not found\n");
+		exit(1);
+	}
+	s->eval_word1 = (long long *)malloc(max_num * sizeof(long long));
+	s->eval_word2 = (long long *)malloc(max_num * sizeof(long long));
+	s->eval_gold = (real *)malloc(max_num * sizeof(real));
+	while (fscanf(fin, "%99s %99s %f", word1, word2, &score) == 3) {
+		total++;
+		a = Sem2vecSearchWord(s, word1);
+		b = Sem2vecSearchWord(s, word2);
+		if ((a == -1) || (b == -1)) continue;
+		if (s->eval_num == max_num) {
+			max_num *= 2;
+			s->eval_word1 = (long long *)realloc(s->eval_word1, max_num * sizeof(long long));
+			s->eval_word2 = (long long *)realloc(s->eval_word2, max_num * sizeof(long long));
+			s->eval_gold = (real *)realloc(s->eval_gold, max_num * sizeof(real));
+		}
+		s->eval_word1[s->eval_num] = a;
+		s->eval_word2[s->eval_num] = b;
+		s->eval_gold[s->eval_num] = score;
+		s->eval_num++;
+	}
+	fclose(fin);
+	if (s->debug_mode > 0) printf("Evaluation pairs: %lld of %lld in the vocabulary\n", s->eval_num, total);
+}
+
+struct rank_item {
+	real value;
+	long long index;
+};
+
+static int RankCompare(const void *a, const void *b) {
+	real d = ((struct rank_item *)a)->value - ((struct rank_item *)b)->value;
+	return (d > 0) - (d < 0);
+}
+
+// Replaces values by their ranks, ties get the average rank
+static void Rank(real *values, long long n) {
+	long long a, b, c;
+	struct rank_item *items = (struct rank_item *)malloc(n * sizeof(struct rank_item));
+	for (a = 0; a < n; ++a) {
+		items[a].value = values[a];
+		items[a].index = a;
+	}
+	qsort(items, n, sizeof(struct rank_item), RankCompare);
+	for (a = 0; a < n; a = b) {
+		for (b = a + 1; (b < n) && (items[b].value == items[a].value); ++b);
+		for (c = a; c < b; ++c) values[items[c].index] = (a + b - 1) / 2.0;
+	}
+	free(items);
+}
+
+real Sem2vecEvaluate(struct sem2vec *s) {
+	long long a, eval_num = s->eval_num, layer1_size = s->layer1_size;
+	real len1, len2, mean = (eval_num - 1) / 2.0, cov = 0, var1 = 0, var2 = 0;
+	real *vec1 = (real *)malloc(layer1_size * sizeof(real));
+	real *vec2 = (real *)malloc(layer1_size * sizeof(real));
+	real *sim = (real *)malloc(eval_num * sizeof(real));
+	real *gold = (real *)malloc(eval_num * sizeof(real));
+	for (a = 0; a < eval_num; ++a) {
+		Sem2vecComposeWord(s, s->eval_word1[a], vec1);
+		Sem2vecComposeWord(s, s->eval_word2[a], vec2);
+		len1 = sqrt(vectorDot(vec1, vec1, layer1_size));
+		len2 = sqrt(vectorDot(vec2, vec2, layer1_size));
+		sim[a] = vectorDot(vec1, vec2, layer1_size) / (len1 * len2 + 1e-12);
+	}
+	memcpy(gold, s->eval_gold, eval_num * sizeof(real));
+	Rank(sim, eval_num);
+	Rank(gold, eval_num);
+	for (a = 0; a < eval_num; ++a) {
+		cov += (sim[a] - mean) * (gold[a] - mean);
+		var1 += (sim[a] - mean) * (sim[a] - mean);
+		var2 += (gold[a] - mean) * (gold[a] - mean);
+	}
+	free(vec1);
+	free(vec2);
+	free(sim);
+	free(gold);
+	return cov / (sqrt(var1 * var2) + 1e-12);
+}
+
+real *Sem2vecWordVectors(struct sem2vec *s, long long *rows) {
+	*rows = s->vocab_size;
+	return s->syn0;
+}
+
+real *Sem2vecSememeVectors(struct sem2vec *s, long long *rows) {
+	*rows = s->semantic_num;
+	return s->syn_sem;
+}
+
+real *Sem2vecOutputVectors(struct sem2vec *s, long long *rows) {
+	*rows = s->negative > 0 ? s->vocab_size : 0;
+	return s->syn1neg;
+}
+
+void Sem2vecSaveModel(struct sem2vec *s, const char *file) {
+	long long a, b, layer1_size = s->layer1_size;
+	FILE *fo = fopen(file, "w");
+	if (fo == NULL) {
+		printf("Cannot open the output file\n");
+		exit(1);
+	}
+	fprintf(fo, "%lld %lld %f %lld\n", s->vocab_size, layer1_size, s->alpha, s->semantic_num);
+	for (a = 0; a < s->vocab_size; ++a)
+	{
+		fprintf(fo, "%s ", s->vocab[a].word);
+		for (b = 0; b < layer1_size; ++b)
+		{
+			fprintf(fo, "%lf ", s->syn0[a * layer1_size + b]);
+		}
+		fprintf(fo, "\n");
+	}
+
+	for (a = 0; a < s->semantic_num; ++a)
+	{
+		fprintf(fo, "%d ", s->sememe_id[a]);
+		for (b = 0; b < layer1_size; ++b)
+		{
+			fprintf(fo, "%lf ", s->syn_sem[a * layer1_size + b]);
+		}
+		fprintf(fo, "\n");
+	}
+
+	for (a = 0; a < s->vocab_size * layer1_size; ++a)
+		fprintf(fo, "%lf ", s->syn1neg[a]);
+	fprintf(fo, "\n");
+	fclose(fo);
+}
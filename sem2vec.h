@@ -0,0 +1,151 @@
+// The sem2vec trainer as a library.
+//
+// All the state of a model lives in a `struct sem2vec`, so several models can be
+// trained in one process. A model is built either from files (Sem2vecReadVocab,
+// Sem2vecReadProjection) or from memory (Sem2vecAddWord, Sem2vecSortVocab,
+// Sem2vecSetLists), then allocated with Sem2vecInitNet. Training is driven by the
+// caller: every training thread owns a `struct sem2vec_worker` and feeds it batches
+// of token ids with Sem2vecTrainTokens; the workers of one model update the shared
+// matrices without locks. The matrices are exposed in place, without copies.
+//
+// Like the command line tool, the file readers print an error and exit when a file
+// cannot be read.
+
+#ifndef SEM2VEC_H
+#define SEM2VEC_H
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SEM2VEC_MAX_STRING 100 // longest word read from a file, with its terminating 0
+
+typedef float sem2vec_real;            // Precision of float numbers
+
+struct sem2vec_vocab_word { // record information of a word
+	long long cn; // number of occurrence in train set
+	unsigned int hash; // hash value of the word, kept to rebuild the hash table without rehashing
+	int *point;
+	char *word, *code, codelen;
+	int list_num; // number of lists that contain this word
+	int *in_list; // record which lists contain this word, shared by all words of the same composite
+	int composite; // the distinct list set of this word, -1 if it is in no list
+};
+
+struct sem2vec_hash_slot; // a slot of the private hash tables
+
+struct sem2vec {
+	// training parameters, set before Sem2vecInitNet
+	long long layer1_size, iter;
+	int window, negative, min_count, debug_mode;
+	sem2vec_real alpha, sample;
+
+	struct sem2vec_vocab_word *vocab;
+	struct sem2vec_hash_slot *vocab_hash;
+	long long vocab_hash_size; // a power of two, grown to keep the table at most half full
+	long long vocab_max_size, vocab_size, min_reduce;
+	long long train_words; // expected words per epoch, drives the alpha schedule
+	long long schedule_words; // words the alpha schedule runs over when known in advance, 0 for iter * train_words
+	long long word_count_actual; // words trained so far by all workers
+	sem2vec_real starting_alpha;
+	clock_t start;
+	unsigned long long next_random;
+
+	// The list ids given to Sem2vecSetLists are numbered densely in the order they are
+	// first seen; syn_sem has a row for each of them, no more
+	long long semantic_num, sememe_max_size;
+	int *sememe_id; // the list id of each row of syn_sem
+	struct sem2vec_hash_slot *sememe_hash; // the row of each list id
+	long long sememe_hash_size;
+
+	sem2vec_real *syn0; // the word embeddings. (vocab_size * layer1_size)
+	sem2vec_real *syn_sem; // the semantic vectors. (semantic_num * layer1_size)
+	sem2vec_real *syn1neg; // the output embeddings. (vocab_size * layer1_size)
+	sem2vec_real *expTable;
+	int *table; // unigram table of the negative samples
+
+	// Words with exactly the same lists share one composite, so the lists are stored
+	// and averaged once per composite instead of once per word
+	long long composite_num, composite_max_size;
+	int *composite_list_num;
+	int **composite_in_list;
+	struct sem2vec_hash_slot *composite_hash;
+	long long composite_hash_size;
+
+	long long incremental_vocab_size; // number of words in the model given to Sem2vecReadIncrementalVocab
+	long long *incremental_map; // position of each word of that model in the current vocabulary
+
+	long long eval_num, *eval_word1, *eval_word2; // the evaluation pairs found in the vocabulary
+	sem2vec_real *eval_gold;
+};
+
+// The per-thread state of training: random numbers, gradients and word counts
+struct sem2vec_worker {
+	struct sem2vec *model;
+	unsigned long long next_random;
+	sem2vec_real *neu1e;
+	sem2vec_real *input_embed; // this is for the input word in skip-gram
+	long long word_count, last_word_count;
+};
+
+// Creates a model with the default parameters and an empty vocabulary
+struct sem2vec *Sem2vecCreate(void);
+void Sem2vecFree(struct sem2vec *s);
+
+// Vocabulary
+long long Sem2vecAddWord(struct sem2vec *s, const char *word, long long cn);
+long long Sem2vecSearchWord(struct sem2vec *s, const char *word);
+// Sorts by count, drops words below min_count and sets train_words. Word 0 must be
+// </s>, the end of a line: it keeps its place whatever its count, and negative
+// sampling never draws it.
+void Sem2vecSortVocab(struct sem2vec *s);
+// Builds the vocabulary from a training file; returns the size of the file
+long long Sem2vecLearnVocab(struct sem2vec *s, const char *file);
+// Sets the lists of a word; replaces the list ids of `lists` by their syn_sem rows and
+// sorts them in place. Returns 0, or -1 without changing anything when a list id is
+// negative or, once Sem2vecInitNet has run, has no row in syn_sem.
+int Sem2vecSetLists(struct sem2vec *s, long long word, int *lists, long long num);
+
+// Training
+void Sem2vecInitNet(struct sem2vec *s);
+struct sem2vec_worker *Sem2vecCreateWorker(struct sem2vec *s, unsigned long long seed);
+// Adds the words a worker trained since its last update to word_count_actual; the
+// workers only do it every 10000 words, and Sem2vecFreeWorker does it at the end
+void Sem2vecFlushWorker(struct sem2vec_worker *w);
+void Sem2vecFreeWorker(struct sem2vec_worker *w);
+// Trains on a batch of token ids (-1 for unknown words) with skip-gram and negative sampling
+void Sem2vecTrainTokens(struct sem2vec_worker *w, const long long *tokens, long long num);
+// Writes the vector of a word into `vec`; words with lists are composed from their sememes
+void Sem2vecComposeWord(struct sem2vec *s, long long word, sem2vec_real *vec);
+// Replaces the syn0 rows of words with lists by their composition, once training is done
+void Sem2vecCompose(struct sem2vec *s);
+// Fraction of the alpha schedule done so far
+sem2vec_real Sem2vecProgress(struct sem2vec *s);
+// Spearman correlation of the cosine similarities with the evaluation set
+sem2vec_real Sem2vecEvaluate(struct sem2vec *s);
+
+// Zero-copy views of the matrices, `rows` receives the number of rows of layer1_size floats
+sem2vec_real *Sem2vecWordVectors(struct sem2vec *s, long long *rows);
+sem2vec_real *Sem2vecSememeVectors(struct sem2vec *s, long long *rows); // row r is list id sememe_id[r]
+sem2vec_real *Sem2vecOutputVectors(struct sem2vec *s, long long *rows);
+
+// Files
+void Sem2vecReadWord(char *word, FILE *fin);
+long long Sem2vecReadWordIndex(struct sem2vec *s, FILE *fin);
+void Sem2vecReadVocab(struct sem2vec *s, const char *file);
+void Sem2vecSaveVocab(struct sem2vec *s, const char *file);
+void Sem2vecReadProjection(struct sem2vec *s, const char *file);
+void Sem2vecReadCheckpoint(struct sem2vec *s, const char *file);
+void Sem2vecReadIncrementalVocab(struct sem2vec *s, const char *file);
+void Sem2vecReadIncremental(struct sem2vec *s, const char *file);
+void Sem2vecReadEvalSet(struct sem2vec *s, const char *file);
+void Sem2vecSaveModel(struct sem2vec *s, const char *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
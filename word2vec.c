@@ -12,6 +12,7 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+// gcc word2vec.c sem2vec.c -o word2vec -lm -pthread -O3 -march=native -funroll-loops
 // ./word2vec -train /data/disk1/private/nyl/copus2.txt -output vectors12.bin -cbow 0 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -threads 30 -binary 1 -iter 1 -read-vocab ../data2/ReadVocab2700000000 -read-meaning ../ReadMeaning -read-sense ../data2/ReadSenseWord2700000000 -min-count 1
 
 #include <stdio.h>
@@ -19,83 +20,60 @@
 #include <string.h>
 #include <math.h>
 #include <pthread.h>
+#include <time.h>
 #include <signal.h>
+#include "sem2vec.h"
+
+#define MAX_STRING SEM2VEC_MAX_STRING
 
-#define MAX_STRING 100
-#define EXP_TABLE_SIZE 1000
 #define EXP_FROM_ZERO_FORE 1000
-#define MAX_EXP 6
-#define MAX_SENTENCE_LENGTH 1000
-#define MAX_CODE_LENGTH 40
+#define CHUNKS_PER_THREAD 64 // the training file is scheduled in this many chunks per thread
+#define TOKEN_BATCH 10000 // words read from a chunk before they are handed to the trainer
+#define STREAM_BATCHES_PER_THREAD 4 // batches the stream reader may get ahead of the trainers
+#define PQ_KSUB 256 // centroids of each product quantization codebook, so that a code is one byte
+#define PQ_KMEANS_ITER 20
+#define PQ_KMEANS_SAMPLE 256 // training words per centroid
+#define PQ_EVAL_QUERIES 100 // random words whose neighbours measure the recall of the export
+#define PQ_EVAL_K 10
+
+typedef sem2vec_real real;
 int MAX_LIST_NUM = 400; // sample at most 200 lists for each word
 
-const int vocab_hash_size = 10000000;  // Maximum 30 * 0.7 = 21M words in the vocabulary
-const int meaning_hash_size = 10000000;  // Maximum 30 * 0.7 = 21M words in the vocabulary
-
-// Birthday of an important girl. 
-// Thanks to such a fortunate random seed, I get the satisfying results.
-unsigned long long next_random = 19960322;
-
-typedef float real;                    // Precision of float numbers
-
-real pre_exp[EXP_TABLE_SIZE]; // calc exp previously
-
-struct vocab_word { // record information of a word
-	long long cn; // number of occurrence in train set
-	int *point;
-	char *word, *code, codelen;
-	int list_num; // number of lists that contain this word
-	int *in_list; // record which lists contain this word
-};
-
-real vectorDot(real *a, real *b, int l) {
-	int i;
-	real dot = 0;
-	for (i = 0; i < l; ++i)
-		dot += a[i] * b[i];
-	return dot;
-}
+real pre_exp[EXP_FROM_ZERO_FORE]; // calc exp previously
 
 char train_file[MAX_STRING], output_file[MAX_STRING], checkpoint[MAX_STRING];
+char incremental_file[MAX_STRING]; // an existing model to continue training on new data
+char eval_file[MAX_STRING]; // word pairs with similarity scores, evaluated during training
 char save_vocab_file[MAX_STRING], read_vocab_file[MAX_STRING], read_meaning_file[MAX_STRING], read_sense_file[MAX_STRING];
 char read_semantic_proj[MAX_STRING]; // from which file to read the semantic projections
-
-struct vocab_word *vocab;
-int binary = 0, cbow = 1, debug_mode = 2, window = 5, min_count = 5, num_threads = 12, min_reduce = 1;
-int *vocab_hash;
-long long vocab_max_size = 1000, vocab_size = 0, layer1_size = 100, semantic_num = 450000;
-long long train_words = 0, word_count_actual = 0, iter = 5, file_size = 0, classes = 0;
-real alpha = 0.025, starting_alpha, sample = 1e-3;
-real *syn1neg, *expTable;
-clock_t start;
-
-real *syn0; // the word embeddings. (vocab_size * layer1_size)
-real *syn_sem; // the semantic vectors. (semantic_num * layer1_size)
-
-real *proj; // the projection of words to the semantic bases. (vocab_size * semantic_num)
-int *in_list; // whether the words are in the list vocabulary.
-
-int hs = 0, negative = 5;
-const int table_size = 1e8;
-int *table;
-
-void InitUnigramTable() {
-	int a, i;
-	double train_words_pow = 0;
-	double d1, power = 0.75;
-	table = (int *)malloc(table_size * sizeof(int));
-	for (a = 0; a < vocab_size; a++) train_words_pow += pow(vocab[a].cn, power);
-	i = 0;
-	d1 = pow(vocab[i].cn, power) / train_words_pow;
-	for (a = 0; a < table_size; a++) {
-		table[a] = i;
-		if (a / (double)table_size > d1) {
-			i++;
-			d1 += pow(vocab[i].cn, power) / train_words_pow;
-		}
-		if (i >= vocab_size) i = vocab_size - 1;
-	}
-}
+char pq_output_file[MAX_STRING]; // the word vectors, product quantized for serving
+
+struct sem2vec *model; // the model trained by this tool
+int binary = 0, cbow = 1, num_threads = 12, hs = 0;
+long long file_size = 0, classes = 0;
+
+long long num_chunks; // the training file is split into chunks of whole lines
+long long *chunk_offset; // chunk c spans bytes [chunk_offset[c], chunk_offset[c + 1])
+long long chunk_cursor = 0; // next (epoch, chunk) pair to train, shared by all threads
+double *thread_finish; // when each thread ran out of chunks
+
+long long stream_words = -1; // expected words of a streamed training file, -1 when the file is not streamed
+long long stream_read = 0; // words read from the stream so far
+long long **stream_batch, *stream_num; // ring of batches read but not trained yet; a slot owns its buffer
+int stream_size, stream_head = 0, stream_count = 0, stream_eof = 0;
+pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t stream_not_empty = PTHREAD_COND_INITIALIZER, stream_not_full = PTHREAD_COND_INITIALIZER;
+
+long long pq_m = 0; // sub-vectors of a quantized word vector, 0 for layer1_size / 4
+long long pq_ksub, pq_dsub; // centroids per codebook and floats per sub-vector
+long long pq_train_num, *pq_sample; // the words the codebooks are trained on
+real *pq_codebook; // pq_m codebooks of pq_ksub centroids of pq_dsub floats
+unsigned char *pq_codes; // pq_m codes per word
+long long pq_eval_found = 0; // exact neighbours also found by the asymmetric distance
+
+real eval_interval = 60, early_stop = 0; // seconds between evaluations, minimal improvement to go on
+int eval_patience = 2; // evaluations without enough improvement before stopping
+volatile int training_done = 0, stop_training = 0;
 
 int ReadVocabInt(FILE *fin) {
 	int a = 0, ch, sub = '0';
@@ -122,30 +100,6 @@ void ReadVocabWord(char *word, FILE *fin) {
 	word[a] = 0;
 }
 
-// Reads a single word from a file, assuming space + tab + EOL to be word boundaries
-void ReadWord(char *word, FILE *fin) {
-	int a = 0, ch;
-	while (!feof(fin)) {
-		ch = fgetc(fin);
-		if (ch == 13) continue;
-		if ((ch == ' ') || (ch == '\t') || (ch == '\n')) {
-			if (a > 0) {
-				if (ch == '\n') ungetc(ch, fin);
-				break;
-			}
-			if (ch == '\n') {
-				strcpy(word, (char *)"</s>");
-				return;
-			}
-			else continue;
-		}
-		word[a] = ch;
-		a++;
-		if (a >= MAX_STRING - 1) a--;   // Truncate too long words
-	}
-	word[a] = 0;
-}
-
 // Reads a single word from a file, assuming space + tab + EOL to be word boundaries
 void ReadMeaningWord(char *word, FILE *fin) {
 	int a = 0, ch;
@@ -161,625 +115,459 @@ void ReadMeaningWord(char *word, FILE *fin) {
 	word[a] = 0;
 }
 
-// Returns hash value of a word
-int GetWordHash(char *word) {
-	unsigned long long a, hash = 0;
-	for (a = 0; a < strlen(word); a++) hash = hash * 257 + word[a];
-	hash = hash % vocab_hash_size;
-	return hash;
+double WallTime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-// Returns position of a word in the vocabulary; if the word is not found, returns -1
-int SearchVocab(char *word) {
-	unsigned int hash = GetWordHash(word);
-	while (1) {
-		if (vocab_hash[hash] == -1) return -1;
-		if (!strcmp(word, vocab[vocab_hash[hash]].word)) return vocab_hash[hash];
-		hash = (hash + 1) % vocab_hash_size;
-	}
-	return -1;
-}
-
-// Reads a word and returns its index in the vocabulary
-int ReadWordIndex(FILE *fin) {
-	char word[MAX_STRING];
-	ReadWord(word, fin);
-	if (feof(fin)) return -1;
-	return SearchVocab(word);
-}
-
-// Adds a word to the vocabulary
-int AddWordToVocab(char *word) {
-	unsigned int hash, length = strlen(word) + 1;
-	if (length > MAX_STRING) length = MAX_STRING;
-	vocab[vocab_size].word = (char *)calloc(length, sizeof(char));
-	strcpy(vocab[vocab_size].word, word);
-	vocab[vocab_size].cn = 0;
-	vocab[vocab_size].list_num = 0;
-	vocab[vocab_size].in_list = NULL;
-	vocab_size++;
-	// Reallocate memory if needed
-	if (vocab_size + 2 >= vocab_max_size) {
-		vocab_max_size += 1000;
-		vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
-	}
-	hash = GetWordHash(word);
-	while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-	vocab_hash[hash] = vocab_size - 1;
-	return vocab_size - 1;
-}
-
-// Used later for sorting by word counts
-int VocabCompare(const void *a, const void *b) {
-	return ((struct vocab_word *)b)->cn - ((struct vocab_word *)a)->cn;
+// Splits the training file into chunks starting at line boundaries
+void InitChunks() {
+	long long a;
+	int ch;
+	FILE *fin = fopen(train_file, "rb");
+	num_chunks = num_threads * CHUNKS_PER_THREAD;
+	if (num_chunks > file_size) num_chunks = file_size > 0 ? file_size : 1;
+	chunk_offset = (long long *)malloc((num_chunks + 1) * sizeof(long long));
+	chunk_offset[0] = 0;
+	for (a = 1; a < num_chunks; ++a) {
+		fseek(fin, file_size / num_chunks * a - 1, SEEK_SET);
+		while (((ch = fgetc(fin)) != '\n') && (ch != EOF));
+		chunk_offset[a] = ftell(fin);
+	}
+	chunk_offset[num_chunks] = file_size;
+	fclose(fin);
+	chunk_cursor = 0;
+	thread_finish = (double *)calloc(num_threads, sizeof(double));
 }
 
-// Sorts the vocabulary by frequency using word counts
-void SortVocab() {
-	int a, size;
-	unsigned int hash;
-	// Sort the vocabulary and keep </s> at the first position
-	qsort(&vocab[0], vocab_size - 1, sizeof(struct vocab_word), VocabCompare);
-	for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-	size = vocab_size;
-	train_words = 0;
-	for (a = 0; a < size; a++) {
-		// Words occuring less than min_count times will be discarded from the vocab
-		if ((vocab[a].cn < min_count) && (a != 0)) {
-			vocab_size--;
-			free(vocab[a].word);
-		}
-		else {
-			// Hash will be re-computed, as after the sorting it is not actual
-			hash = GetWordHash(vocab[a].word);
-			while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-			vocab_hash[hash] = a;
-			train_words += vocab[a].cn;
+// Scores the live vectors every `eval_interval` seconds without pausing the
+// training threads, and asks them to stop once the score stops improving
+void *EvalModelThread(void *arg) {
+	int waiting = 0;
+	real score, best = -2;
+	double last = WallTime();
+	struct timespec tick = {0, 100000000};
+	while (!training_done) {
+		nanosleep(&tick, NULL);
+		if (WallTime() - last < eval_interval) continue;
+		last = WallTime();
+		score = Sem2vecEvaluate(model);
+		printf("\nEval: spearman %.4f  Progress: %.2f%%\n", score, Sem2vecProgress(model) * 100);
+		fflush(stdout);
+		if (score >= best + early_stop) waiting = 0;
+		else waiting++;
+		if (score > best) best = score;
+		if ((early_stop > 0) && (waiting >= eval_patience) && !stop_training) {
+			printf("Early stop: no improvement of %f in %d evaluations\n", early_stop, eval_patience);
+			stop_training = 1;
 		}
 	}
-	vocab = (struct vocab_word *)realloc(vocab, (vocab_size + 1) * sizeof(struct vocab_word));
-	// Allocate memory for the binary tree construction
-	for (a = 0; a < vocab_size; a++) {
-		vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
-		vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
-	}
+	pthread_exit(NULL);
 }
 
-// Reduces the vocabulary by removing infrequent tokens
-void ReduceVocab() {
-	int a, b = 0;
-	unsigned int hash;
-	for (a = 0; a < vocab_size; a++) 
-		if (vocab[a].cn > min_reduce) {
-			vocab[b].cn = vocab[a].cn;
-			vocab[b].word = vocab[a].word;
-			b++;
-		}
-		else free(vocab[a].word);
-	vocab_size = b;
-	for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-	for (a = 0; a < vocab_size; a++) {
-		// Hash will be re-computed, as it is not actual
-		hash = GetWordHash(vocab[a].word);
-		while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-		vocab_hash[hash] = a;
-	}
-	fflush(stdout);
-	min_reduce++;
-}
+void *TrainModelThread(void *id) {
+	long long word, num, chunk, chunk_end = 0;
+	int chunk_done = 1;
+	char text[MAX_STRING];
+	long long *tokens = (long long *)malloc(TOKEN_BATCH * sizeof(long long));
+	struct sem2vec_worker *worker = Sem2vecCreateWorker(model, model->next_random + (long long)id);
+	FILE *fi = fopen(train_file, "rb");
 
-// Create binary Huffman tree using the word counts
-// Frequent words will have short uniqe binary codes
-void CreateBinaryTree() {
-	long long a, b, i, min1i, min2i, pos1, pos2, point[MAX_CODE_LENGTH];
-	char code[MAX_CODE_LENGTH];
-	long long *count = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
-	long long *binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
-	long long *parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
-	for (a = 0; a < vocab_size; a++) count[a] = vocab[a].cn;
-	for (a = vocab_size; a < vocab_size * 2; a++) count[a] = 1e15;
-	pos1 = vocab_size - 1;
-	pos2 = vocab_size;
-	// Following algorithm constructs the Huffman tree by adding one node at a time
-	for (a = 0; a < vocab_size - 1; a++) {
-		// First, find two smallest nodes 'min1, min2'
-		if (pos1 >= 0) {
-			if (count[pos1] < count[pos2]) {
-				min1i = pos1;
-				pos1--;
-			}
-			else {
-				min1i = pos2;
-				pos2++;
-			}
-		}
-		else {
-			min1i = pos2;
-			pos2++;
+	while (1) {
+		if (chunk_done) { // take the next chunk of any epoch
+			if (stop_training) break;
+			chunk = __sync_fetch_and_add(&chunk_cursor, 1);
+			if (chunk >= model->iter * num_chunks) break;
+			chunk %= num_chunks;
+			fseek(fi, chunk_offset[chunk], SEEK_SET);
+			chunk_end = chunk_offset[chunk + 1];
+			chunk_done = chunk_offset[chunk] >= chunk_end;
 		}
-		if (pos1 >= 0) {
-			if (count[pos1] < count[pos2]) {
-				min2i = pos1;
-				pos1--;
-			}
-			else {
-				min2i = pos2;
-				pos2++;
+		num = 0;
+		while ((num < TOKEN_BATCH) && !chunk_done) {
+			Sem2vecReadWord(text, fi);
+			if (feof(fi)) {
+				chunk_done = 1;
+				break;
 			}
+			// chunks end at line boundaries, so the position is only looked at after a line
+			if (!strcmp(text, "</s>")) chunk_done = ftell(fi) >= chunk_end;
+			word = Sem2vecSearchWord(model, text);
+			if (word == -1) continue;
+			tokens[num++] = word;
 		}
-		else {
-			min2i = pos2;
-			pos2++;
-		}
-		count[vocab_size + a] = count[min1i] + count[min2i];
-		parent_node[min1i] = vocab_size + a;
-		parent_node[min2i] = vocab_size + a;
-		binary[min2i] = 1;
+		if (num > 0) Sem2vecTrainTokens(worker, tokens, num);
 	}
-	// Now assign binary code to each vocabulary word
-	for (a = 0; a < vocab_size; a++) {
-		b = a;
-		i = 0;
-		while (1) {
-			code[i] = binary[b];
-			point[i] = b;
-			i++;
-			b = parent_node[b];
-			if (b == vocab_size * 2 - 2) break;
-		}
-		vocab[a].codelen = i;
-		vocab[a].point[0] = vocab_size - 2;
-		for (b = 0; b < i; b++) {
-			vocab[a].code[i - b - 1] = code[b];
-			vocab[a].point[i - b] = point[b] - vocab_size;
-		}
-	}
-	free(count);
-	free(binary);
-	free(parent_node);
+
+	thread_finish[(long long)id] = WallTime();
+	fclose(fi);
+	free(tokens);
+	Sem2vecFreeWorker(worker);
+
+	printf("train end\n");
+
+	pthread_exit(NULL);
 }
 
-void LearnVocabFromTrainFile() {
-	char word[MAX_STRING];
-	FILE *fin;
-	long long a, i;
-	for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-	fin = fopen(train_file, "rb");
-	if (fin == NULL) {
+// Reads the training stream once and queues it in batches of word ids; waits
+// while the queue is full, so the reader never gets far ahead of the trainers
+void *StreamReaderThread(void *arg) {
+	int a;
+	long long word, num, *tokens = (long long *)malloc(TOKEN_BATCH * sizeof(long long)), *swap;
+	FILE *fi = strcmp(train_file, "-") ? fopen(train_file, "rb") : stdin;
+	if (fi == NULL) {
 		printf("ERROR: training data file not found!\n");
 		exit(1);
 	}
-	vocab_size = 0;
-	AddWordToVocab((char *)"</s>");
-	while (1) {
-		ReadWord(word, fin);
-		if (feof(fin)) break;
-		train_words++;
-		if ((debug_mode > 1) && (train_words % 100000 == 0)) {
-			printf("%lldK%c", train_words / 1000, 13);
-			fflush(stdout);
+	while (!feof(fi) && !stop_training) {
+		num = 0;
+		while (num < TOKEN_BATCH) {
+			word = Sem2vecReadWordIndex(model, fi);
+			if (feof(fi)) break;
+			if (word == -1) continue;
+			tokens[num++] = word;
 		}
-		i = SearchVocab(word);
-		if (i == -1) {
-			a = AddWordToVocab(word);
-			vocab[a].cn = 1;
+		if (num == 0) continue;
+		pthread_mutex_lock(&stream_lock);
+		while ((stream_count == stream_size) && !stop_training) pthread_cond_wait(&stream_not_full, &stream_lock);
+		if (!stop_training) { // the filled buffer goes into the ring, the free one of the slot comes back
+			a = (stream_head + stream_count) % stream_size;
+			swap = stream_batch[a];
+			stream_batch[a] = tokens;
+			tokens = swap;
+			stream_num[a] = num;
+			stream_count++;
+			stream_read += num;
+			pthread_cond_signal(&stream_not_empty);
 		}
-		else vocab[i].cn++;
-		if (vocab_size > vocab_hash_size * 0.7) ReduceVocab();
-	}
-	SortVocab();
-	if (debug_mode > 0) {
-		printf("Vocab size: %lld\n", vocab_size);
-		printf("Words in train file: %lld\n", train_words);
-	}
-	file_size = ftell(fin);
-	fclose(fin);
-}
-
-void SaveVocab() {
-	long long i;
-	FILE *fo = fopen(save_vocab_file, "wb");
-	for (i = 0; i < vocab_size; i++) fprintf(fo, "%s %lld\n", vocab[i].word, vocab[i].cn);
-	fclose(fo);
+		pthread_mutex_unlock(&stream_lock);
+	}
+	pthread_mutex_lock(&stream_lock);
+	stream_eof = 1;
+	pthread_cond_broadcast(&stream_not_empty);
+	pthread_mutex_unlock(&stream_lock);
+	if (fi != stdin) fclose(fi);
+	free(tokens);
+	pthread_exit(NULL);
 }
 
-void ReadVocab() {
-	long long a, i = 0;
-	char c;
-	char word[MAX_STRING];
-	FILE *fin = fopen(read_vocab_file, "rb");
-	if (fin == NULL) {
-		printf("Vocabulary file not found\n");
-		exit(1);
-	}
-	for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-	vocab_size = 0;
+// Trains on the batches queued by StreamReaderThread until the stream ends
+void *TrainStreamThread(void *id) {
+	long long num, *tokens = (long long *)malloc(TOKEN_BATCH * sizeof(long long)), *swap;
+	struct sem2vec_worker *worker = Sem2vecCreateWorker(model, model->next_random + (long long)id);
 	while (1) {
-		ReadWord(word, fin);
-		if (feof(fin)) break;
-		a = AddWordToVocab(word);
-		fscanf(fin, "%lld%c", &vocab[a].cn, &c);
-		// if (vocab[a].cn < 50)
-		// 	break;
-		i++;
-	}
-	SortVocab();
-	if (debug_mode > 0) {
-		printf("Vocab size: %lld\n", vocab_size);
-		printf("Words in train file: %lld\n", train_words);
-	}
-	fin = fopen(train_file, "rb");
-	if (fin == NULL) {
-		printf("ERROR: training data file not found!\n");
-		exit(1);
-	}
-	fseek(fin, 0, SEEK_END);
-	file_size = ftell(fin);
-	fclose(fin);
-	printf("%lld\n", vocab_size);
+		pthread_mutex_lock(&stream_lock);
+		while ((stream_count == 0) && !stream_eof && !stop_training) pthread_cond_wait(&stream_not_empty, &stream_lock);
+		if ((stream_count == 0) || stop_training) {
+			pthread_cond_broadcast(&stream_not_full); // the reader may wait for room that will never come
+			pthread_mutex_unlock(&stream_lock);
+			break;
+		}
+		swap = stream_batch[stream_head];
+		stream_batch[stream_head] = tokens;
+		tokens = swap;
+		num = stream_num[stream_head];
+		stream_head = (stream_head + 1) % stream_size;
+		stream_count--;
+		pthread_cond_signal(&stream_not_full);
+		pthread_mutex_unlock(&stream_lock);
+		Sem2vecTrainTokens(worker, tokens, num);
+	}
+	thread_finish[(long long)id] = WallTime();
+	free(tokens);
+	Sem2vecFreeWorker(worker);
+	printf("train end\n");
+	pthread_exit(NULL);
 }
 
-// restore from a given file(state)
-void ReadPoint() {
-	int a, b;
-	FILE *fin = fopen(checkpoint, "r");
-	fscanf(fin, "%lld %lld %f\n", &vocab_size, &layer1_size, &alpha);
-	char c;
-	char waste[MAX_STRING];
-	for (a = 0; a < vocab_size; ++a) {
-		fscanf(fin, "%s ", waste);
-		for (b = 0; b < layer1_size; ++b)
-			fscanf(fin, "%f ", &syn0[a * layer1_size + b]);
-		fscanf(fin, "%c", &c);
-	}
-	for (a = 0; a < semantic_num; ++a) {
-		for (b = 0; b < layer1_size; ++b)
-			fscanf(fin, "%f ", &syn_sem[a * layer1_size + b]);
-		fscanf(fin, "%c", &c);
-	}
-	for (a = 0; a < vocab_size * layer1_size; ++a)
-		fscanf(fin, "%f ", &(syn1neg[a]));
-	fscanf(fin, "%c", &c);
-	fclose(fin);
-	printf("checkpoint end\n");
+void InitStream() {
+	int a;
+	stream_size = num_threads * STREAM_BATCHES_PER_THREAD;
+	stream_batch = (long long **)malloc(stream_size * sizeof(long long *));
+	stream_num = (long long *)malloc(stream_size * sizeof(long long));
+	for (a = 0; a < stream_size; a++) stream_batch[a] = (long long *)malloc(TOKEN_BATCH * sizeof(long long));
+	thread_finish = (double *)calloc(num_threads, sizeof(double));
 }
 
-void ReadProjection()
-{
-	/* This function reads the semantic projections of words
-	** from the file pointed by `read_semantic_proj`.
-	*/
-
-	long long a, num, i, j;
-	char word[MAX_STRING];
-	char ch;
-	
-	int max_list_contain = 600000; // a word might appear in 600,000 lists
-	int *temp = (int *)malloc(max_list_contain * sizeof(int));
-	FILE *fi = fopen(read_semantic_proj, "rb");
-
-	if (fi == NULL)
-	{
-		printf("Semantic file not found!\n");
-		exit(1);
-	}
-
-	num = 0;
-
-	while (1)
-	{
-		ReadWord(word, fi);
-
-		if (feof(fi))
-			break;
-
-		num++;
-		if (num % 10000 == 0)
-		{
-			printf("%cHave read %lld0K word semantics", 13, num / 10000);
-			fflush(stdout);
+// Returns the centroid of a codebook closest to a sub-vector
+int QuantizeSub(real *codebook, real *v) {
+	long long b, c;
+	int best = 0;
+	real d, diff, bestd = 1e30;
+	for (c = 0; c < pq_ksub; ++c) {
+		d = 0;
+		for (b = 0; b < pq_dsub; ++b) {
+			diff = v[b] - codebook[c * pq_dsub + b];
+			d += diff * diff;
 		}
-
-		fscanf(fi, "%lld", &a);
-		ch = getc(fi); // the white space
-		fread((void *)temp, sizeof(int), a, fi);
-		ch = getc(fi); // the new line
-
-		i = SearchVocab(word);
-		if (i == -1)
-		{
-			continue;
+		if (d < bestd) {
+			bestd = d;
+			best = c;
 		}
-
-		vocab[i].list_num = a;
-		vocab[i].in_list = (int *)malloc(a * sizeof(int));
-		memcpy(vocab[i].in_list, temp, a * sizeof(int));
 	}
-
-	free(temp);
-	fclose(fi);
+	return best;
 }
 
-// init some data structures
-void InitNet() {
-	long long a, b;
-	a = posix_memalign((void **)&syn0, 128, (long long)vocab_size * layer1_size * sizeof(real));
-	if (syn0 == NULL)
-	{
-		printf("Memory allocation failed\n");
-		exit(1);
+// Trains the codebooks of sub-vectors id, id + num_threads, ... by k-means on the
+// sampled words, then encodes every word with them
+void *TrainCodebookThread(void *id) {
+	long long a, b, c, j, iter, layer1_size = model->layer1_size;
+	unsigned long long next_random = model->next_random + (long long)id;
+	real *syn0 = model->syn0, *codebook, *v;
+	int *assign = (int *)malloc(pq_train_num * sizeof(int));
+	long long *count = (long long *)malloc(pq_ksub * sizeof(long long));
+	for (j = (long long)id; j < pq_m; j += num_threads) {
+		codebook = &pq_codebook[j * pq_ksub * pq_dsub];
+		for (c = 0; c < pq_ksub; ++c)
+			memcpy(&codebook[c * pq_dsub], &syn0[pq_sample[c] * layer1_size + j * pq_dsub], pq_dsub * sizeof(real));
+		for (iter = 0; iter < PQ_KMEANS_ITER; ++iter) {
+			for (a = 0; a < pq_train_num; ++a)
+				assign[a] = QuantizeSub(codebook, &syn0[pq_sample[a] * layer1_size + j * pq_dsub]);
+			memset(codebook, 0, pq_ksub * pq_dsub * sizeof(real));
+			memset(count, 0, pq_ksub * sizeof(long long));
+			for (a = 0; a < pq_train_num; ++a) {
+				v = &syn0[pq_sample[a] * layer1_size + j * pq_dsub];
+				count[assign[a]]++;
+				for (b = 0; b < pq_dsub; ++b) codebook[assign[a] * pq_dsub + b] += v[b];
+			}
+			for (c = 0; c < pq_ksub; ++c) {
+				if (count[c] == 0) { // reseed an empty centroid with a random training word
+					next_random = next_random * (unsigned long long)25214903917 + 11;
+					a = pq_sample[(next_random >> 16) % pq_train_num];
+					memcpy(&codebook[c * pq_dsub], &syn0[a * layer1_size + j * pq_dsub], pq_dsub * sizeof(real));
+				}
+				else for (b = 0; b < pq_dsub; ++b) codebook[c * pq_dsub + b] /= count[c];
+			}
+		}
+		for (a = 0; a < model->vocab_size; ++a)
+			pq_codes[a * pq_m + j] = QuantizeSub(codebook, &syn0[a * layer1_size + j * pq_dsub]);
 	}
+	free(assign);
+	free(count);
+	pthread_exit(NULL);
+}
 
-	a = posix_memalign((void **)&syn_sem, 128, (long long)semantic_num * layer1_size * sizeof(real));
-	if (syn_sem == NULL)
-	{
-		printf("Memory allocation failed\n");
-		exit(1);
-	}
-	
-	if (negative > 0)
-	{
-		a = posix_memalign((void **)&syn1neg, 128, (long long)vocab_size * layer1_size * sizeof(real));
-		if (syn1neg == NULL) { printf("Memory allocation failed\n"); exit(1); }
-		for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++)
-			syn1neg[a * layer1_size + b] = 0;
+// Keeps best[0 .. PQ_EVAL_K) sorted by decreasing similarity
+void InsertBest(long long *best, real *bestd, long long id, real d) {
+	int a;
+	if (d <= bestd[PQ_EVAL_K - 1]) return;
+	for (a = PQ_EVAL_K - 1; (a > 0) && (bestd[a - 1] < d); --a) {
+		bestd[a] = bestd[a - 1];
+		best[a] = best[a - 1];
 	}
-
-	for (a = 0; a < vocab_size; ++a)
-		for (b = 0; b < layer1_size; ++b)
-		{
-			next_random = next_random * (unsigned long long)25214903917 + 11;
-			syn0[a * layer1_size + b] = (((next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
-		}
-
-	for (a = 0; a < semantic_num; ++a)
-		for (b = 0; b < layer1_size; ++b)
-		{
-			next_random = next_random * (unsigned long long)25214903917 + 11;
-			syn_sem[a * layer1_size + b] = (((next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
-		}
-	//CreateBinaryTree();
+	bestd[a] = d;
+	best[a] = id;
 }
 
-void *TrainModelThread(void *id) {
-	long long a, b, d, word, last_word, sentence_length = 0, sentence_position = 0;
-	long long p;
-	long long word_count = 0, last_word_count = 0, sen[MAX_SENTENCE_LENGTH + 1];
-	long long l1, l2, c, target, label, local_iter = iter;
-	real f, g;
-	clock_t now;
-	real *neu1e = (real *)calloc(layer1_size, sizeof(real));
-	FILE *fi = fopen(train_file, "rb");
-	fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
-
-	real *input_embed = (real *)calloc(layer1_size, sizeof(real)); // this is for the input word in skip-gram
-	int local_list_num;
-	int *local_list;
-
-	while (1) {
-		if (word_count - last_word_count > 10000) { // update alpha and some other params
-			word_count_actual += word_count - last_word_count;
-			last_word_count = word_count;
-			if ((debug_mode > 1)) {
-				now = clock();
-				printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, alpha,
-					word_count_actual / (real)(iter * train_words + 1) * 100,
-					word_count_actual / ((real)(now - start + 1) / (real)CLOCKS_PER_SEC * 1000));
-				fflush(stdout);
-				if (word_count_actual / (real)(iter * train_words + 1) * 100 > 99) break;
-			}
-			alpha = starting_alpha * (1 - word_count_actual / (real)(iter * train_words + 1));
-			if (alpha < starting_alpha * 0.0001) alpha = starting_alpha * 0.0001;
+// Compares the neighbours of random words under the exact dot product and under the
+// asymmetric distance, the dot product of the exact query with the quantized words
+void *EvalQuantizedThread(void *id) {
+	long long a, b, c, j, q, word, found = 0, layer1_size = model->layer1_size;
+	long long exact[PQ_EVAL_K], approx[PQ_EVAL_K];
+	real exactd[PQ_EVAL_K], approxd[PQ_EVAL_K], d, *query;
+	real *lut = (real *)malloc(pq_m * pq_ksub * sizeof(real));
+	unsigned char *code;
+	for (q = (long long)id; q < PQ_EVAL_QUERIES; q += num_threads) {
+		word = pq_sample[q % pq_train_num];
+		query = &model->syn0[word * layer1_size];
+		for (j = 0; j < pq_m; ++j) for (c = 0; c < pq_ksub; ++c) {
+			d = 0;
+			for (b = 0; b < pq_dsub; ++b) d += query[j * pq_dsub + b] * pq_codebook[(j * pq_ksub + c) * pq_dsub + b];
+			lut[j * pq_ksub + c] = d;
 		}
-		if (sentence_length == 0) { // get new sentence to train
-			while (1) {
-				word = ReadWordIndex(fi);
-				if (feof(fi)) {
-					break;
-				}
-				if (word == -1) {
-					continue;
-				}
-				word_count++;
-				if (sample > 0) {
-					real ran = (sqrt(vocab[word].cn / (sample * train_words)) + 1) * (sample * train_words) / vocab[word].cn;
-					next_random = next_random * (unsigned long long)25214903917 + 11;
-					if (ran < (next_random & 0xFFFF) / (real)65536) continue;
-				}
-				sen[sentence_length] = word;
-				sentence_length++;
-				if (sentence_length >= MAX_SENTENCE_LENGTH) break;
-			}
-			sentence_position = 0;
+		for (b = 0; b < PQ_EVAL_K; ++b) {
+			exact[b] = approx[b] = -1;
+			exactd[b] = approxd[b] = -1e30;
 		}
-		if (feof(fi) || (word_count > train_words / num_threads)) { // locate the file pointer
-			word_count_actual += word_count - last_word_count;
-			local_iter--;
-			if (local_iter == 0) break;
-			word_count = 0;
-			last_word_count = 0;
-			sentence_length = 0;
-			fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
-			continue;
+		for (a = 0; a < model->vocab_size; ++a) {
+			if (a == word) continue;
+			d = 0;
+			for (b = 0; b < layer1_size; ++b) d += query[b] * model->syn0[a * layer1_size + b];
+			InsertBest(exact, exactd, a, d);
+			code = &pq_codes[a * pq_m];
+			d = 0;
+			for (j = 0; j < pq_m; ++j) d += lut[j * pq_ksub + code[j]];
+			InsertBest(approx, approxd, a, d);
 		}
-		word = sen[sentence_position];
-		if (word == -1) continue;
-		next_random = next_random * (unsigned long long)25214903917 + 11;
-		b = next_random % window;
-
-		for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
-			c = sentence_position - window + a;
-			if (c < 0) continue;
-			if (c >= sentence_length) continue;
-			last_word = sen[c];
-			if (last_word == -1) continue;
-			l1 = last_word * layer1_size;
-
-			if (vocab[last_word].list_num > 0)
-			{
-				local_list_num = vocab[last_word].list_num;
-				local_list = vocab[last_word].in_list;
-
-				// calculate the input word embedding
-				for (c = 0; c < layer1_size; ++c)
-					syn0[l1 + c] = 0;
-				for (p = 0; p < local_list_num; ++p)
-				{
-					for (c = 0; c < layer1_size; ++c)
-						syn0[l1 + c] += syn_sem[local_list[p] * layer1_size + c];
-				}
-				for (c = 0; c < layer1_size; ++c)
-					syn0[l1 + c] /= local_list_num;
-			}
-
-			for (c = 0; c < layer1_size; ++c)
-				neu1e[c] = 0;
-
-			// NEGATIVE SAMPLING
-			if (negative > 0) for (d = 0; d < negative + 1; d++) {
-				if (d == 0) {
-					target = word;
-					label = 1;
-				}
-				else {
-					next_random = next_random * (unsigned long long)25214903917 + 11;
-					target = table[(next_random >> 16) % table_size];
-					if (target == 0) target = next_random % (vocab_size - 1) + 1;
-					if (target == word) continue;
-					label = 0;
-				}
-				l2 = target * layer1_size;
-				f = 0;
-
-				// FP
-				for (c = 0; c < layer1_size; ++c)
-				{
-					f += syn0[l1 + c] * syn1neg[l2 + c];
-				}
-
-				if (f > MAX_EXP)
-					g = (label - 1) * alpha;
-				else if (f < -MAX_EXP)
-					g = (label - 0) * alpha;
-				else
-					g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
-
-				// accumulate the gradients over negative samples
-				for (c = 0; c < layer1_size; ++c)
-					neu1e[c] += g * syn1neg[c + l2];
-
-				// BP for the output layer
-				for (c = 0; c < layer1_size; ++c)
-					syn1neg[c + l2] += g * syn0[l1 + c];
-			}
-
-			// BP
-			if (vocab[last_word].list_num == 0)
-			{
-				// update the word embedding directly
-				for (c = 0; c < layer1_size; ++c)
-					syn0[l1 + c] += neu1e[c];
-			}
+		for (b = 0; b < PQ_EVAL_K; ++b) for (c = 0; c < PQ_EVAL_K; ++c)
+			if ((exact[b] != -1) && (exact[b] == approx[c])) found++;
+	}
+	__sync_fetch_and_add(&pq_eval_found, found);
+	free(lut);
+	pthread_exit(NULL);
+}
 
-			else
-			{
-				// update the sememe embeddings
-				for (p = 0; p < local_list_num; ++p)
-				{
-					for (c = 0; c < layer1_size; ++c)
-						syn_sem[local_list[p] * layer1_size + c] += neu1e[c] / local_list_num;
-				}
+// Writes the normalized word vectors product quantized: every word becomes pq_m one
+// byte codes into codebooks trained by k-means on a sample of the words.
+// The file holds the magic "S2VPQ1", vocab_size, layer1_size, pq_m and pq_ksub as
+// long longs, the codebooks, the words ended by 0 and the codes of every word.
+void SaveQuantized() {
+	long long a, b, c, j, vocab_size = model->vocab_size, layer1_size = model->layer1_size;
+	real len, diff, *v, *codebook;
+	double err = 0, start = WallTime();
+	pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+	FILE *fo;
+	pq_dsub = layer1_size / pq_m;
+	pq_ksub = vocab_size < PQ_KSUB ? vocab_size : PQ_KSUB;
+	for (a = 0; a < vocab_size; ++a) { // the served similarity is the cosine
+		v = &model->syn0[a * layer1_size];
+		len = 0;
+		for (b = 0; b < layer1_size; ++b) len += v[b] * v[b];
+		len = sqrt(len);
+		if (len > 0) for (b = 0; b < layer1_size; ++b) v[b] /= len;
+	}
+	// Partial Fisher-Yates shuffle to draw the training sample
+	pq_train_num = pq_ksub * PQ_KMEANS_SAMPLE;
+	if (pq_train_num > vocab_size) pq_train_num = vocab_size;
+	pq_sample = (long long *)malloc(vocab_size * sizeof(long long));
+	for (a = 0; a < vocab_size; ++a) pq_sample[a] = a;
+	for (a = 0; a < pq_train_num; ++a) {
+		model->next_random = model->next_random * (unsigned long long)25214903917 + 11;
+		b = a + (model->next_random >> 16) % (vocab_size - a);
+		c = pq_sample[a];
+		pq_sample[a] = pq_sample[b];
+		pq_sample[b] = c;
+	}
+	pq_codebook = (real *)malloc(pq_m * pq_ksub * pq_dsub * sizeof(real));
+	pq_codes = (unsigned char *)malloc(vocab_size * pq_m);
+	for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainCodebookThread, (void *)a);
+	for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+	if (model->debug_mode > 0) {
+		for (a = 0; a < vocab_size; ++a) for (j = 0; j < pq_m; ++j) {
+			codebook = &pq_codebook[(j * pq_ksub + pq_codes[a * pq_m + j]) * pq_dsub];
+			for (b = 0; b < pq_dsub; ++b) {
+				diff = model->syn0[a * layer1_size + j * pq_dsub + b] - codebook[b];
+				err += diff * diff;
 			}
 		}
-		sentence_position++;
-		if (sentence_position >= sentence_length) {
-			sentence_length = 0;
-			continue;
-		}
+		for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, EvalQuantizedThread, (void *)a);
+		for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+		printf("Quantized %lld words into %lld codes of %lld centroids in %.2fs\n", vocab_size, pq_m, pq_ksub, WallTime() - start);
+		printf("Reconstruction error (squared, of unit vectors): %.4f\n", err / (vocab_size + (vocab_size == 0)));
+		printf("Recall@%d of the asymmetric distance against fp32: %.4f\n", PQ_EVAL_K,
+			pq_eval_found / (double)(PQ_EVAL_QUERIES * PQ_EVAL_K));
+		printf("Vectors: %lld bytes in fp32, %lld bytes quantized (%.1fx smaller)\n", vocab_size * layer1_size * (long long)sizeof(real),
+			vocab_size * pq_m + pq_m * pq_ksub * pq_dsub * (long long)sizeof(real),
+			vocab_size * layer1_size * sizeof(real) / (double)(vocab_size * pq_m + pq_m * pq_ksub * pq_dsub * sizeof(real)));
+	}
+	fo = fopen(pq_output_file, "wb");
+	if (fo == NULL) {
+		printf("Cannot open the quantized output file\n");
+		exit(1);
 	}
-
-	fclose(fi);
-	free(neu1e);
-	free(input_embed); // free the preallocated memory
-
-	printf("train end\n");
-
-	pthread_exit(NULL);
+	fwrite("S2VPQ1\0", 1, 8, fo); // the magic padded to 8 bytes
+	fwrite(&vocab_size, sizeof(long long), 1, fo);
+	fwrite(&layer1_size, sizeof(long long), 1, fo);
+	fwrite(&pq_m, sizeof(long long), 1, fo);
+	fwrite(&pq_ksub, sizeof(long long), 1, fo);
+	fwrite(pq_codebook, sizeof(real), pq_m * pq_ksub * pq_dsub, fo);
+	for (a = 0; a < vocab_size; ++a) fwrite(model->vocab[a].word, 1, strlen(model->vocab[a].word) + 1, fo);
+	fwrite(pq_codes, 1, vocab_size * pq_m, fo);
+	fclose(fo);
+	free(pq_sample);
+	free(pq_codebook);
+	free(pq_codes);
+	free(pt);
 }
 
 void TrainModel() {
-	long long a, b, c, d;
-	FILE *fo;
+	long long a;
+	double wall_start, wall_end;
+	pthread_t eval_pt, reader_pt;
+	FILE *fin;
 	pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
 	printf("Starting training using file %s\n", train_file);
 
-	if (read_vocab_file[0] != 0) ReadVocab();
+	if (stream_words >= 0) { // the stream can be read only once, so the vocabulary comes first
+		if (read_vocab_file[0] == 0) {
+			printf("ERROR: -stream needs the vocabulary given by -read-vocab\n");
+			exit(1);
+		}
+		Sem2vecReadVocab(model, read_vocab_file);
+		printf("%lld\n", model->vocab_size);
+	}
+	else if (read_vocab_file[0] != 0) {
+		Sem2vecReadVocab(model, read_vocab_file);
+		fin = fopen(train_file, "rb");
+		if (fin == NULL) {
+			printf("ERROR: training data file not found!\n");
+			exit(1);
+		}
+		fseek(fin, 0, SEEK_END);
+		file_size = ftell(fin);
+		fclose(fin);
+		printf("%lld\n", model->vocab_size);
+	}
+	else file_size = Sem2vecLearnVocab(model, train_file);
+	if (incremental_file[0] != 0) {
+		if ((read_vocab_file[0] == 0) || (checkpoint[0] != 0)) {
+			printf("ERROR: -incremental needs -read-vocab of the new data and excludes -checkpoint\n");
+			exit(1);
+		}
+		Sem2vecReadIncrementalVocab(model, incremental_file);
+	}
 	
 	if (read_semantic_proj[0] != 0)
-		ReadProjection(); // read the semantic projections
+		Sem2vecReadProjection(model, read_semantic_proj); // read the semantic projections
 	else
 	{
 		printf("Please specify the semantic file\n");
 		exit(1);
 	}
 
-	if (save_vocab_file[0] != 0) SaveVocab();
-	if (output_file[0] == 0) return;
-	InitNet();
-	if (negative > 0) InitUnigramTable();
+	if (save_vocab_file[0] != 0) Sem2vecSaveVocab(model, save_vocab_file);
+	if ((output_file[0] == 0) && (pq_output_file[0] == 0)) return;
+	Sem2vecInitNet(model);
 	
-	if (checkpoint[0] != 0) ReadPoint();
-	starting_alpha = alpha;
+	if (checkpoint[0] != 0) Sem2vecReadCheckpoint(model, checkpoint);
+	if (incremental_file[0] != 0) Sem2vecReadIncremental(model, incremental_file); // keeps the fresh alpha schedule
+	model->starting_alpha = model->alpha;
 	
-	start = clock();
+	if (stream_words >= 0) {
+		model->iter = 1;
+		model->schedule_words = stream_words > 0 ? stream_words : model->train_words;
+		InitStream();
+	}
+	else InitChunks();
+	if (eval_file[0] != 0) Sem2vecReadEvalSet(model, eval_file);
+	model->start = clock();
+	wall_start = WallTime();
 	printf("\nThe maximum list number is %d\n", MAX_LIST_NUM);
-	for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
-	for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
-
-	for (a = 0; a < vocab_size; ++a)
-	{
-		if (vocab[a].list_num == 0)
-			continue;
-		for (c = 0; c < layer1_size; ++c)
-			syn0[a * layer1_size + c] = 0;
-		for (b = 0; b < vocab[a].list_num; ++b)
-		{
-			for (c = 0; c < layer1_size; ++c)
-				syn0[a * layer1_size + c] += syn_sem[vocab[a].in_list[b] * layer1_size + c];
-		}
-		for (c = 0; c < layer1_size; ++c)
-			syn0[a * layer1_size + c] /= vocab[a].list_num;
-	}
-
-	fo = fopen(output_file, "w");
-	if (classes == 0)
-	{
-		fprintf(fo, "%lld %lld %f\n", vocab_size, layer1_size, alpha);
-		for (a = 0; a < vocab_size; ++a)
-		{
-			fprintf(fo, "%s ", vocab[a].word);
-			for (b = 0; b < layer1_size; ++b)
-			{
-				fprintf(fo, "%lf ", syn0[a * layer1_size + b]);
-			}
-			fprintf(fo, "\n");
-		}
-
-		for (a = 0; a < semantic_num; ++a)
-		{
-			for (b = 0; b < layer1_size; ++b)
-			{
-				fprintf(fo, "%lf ", syn_sem[a * layer1_size + b]);
-			}
-			fprintf(fo, "\n");
-		}
-
-		for (a = 0; a < vocab_size * layer1_size; ++a)
-			fprintf(fo, "%lf ", syn1neg[a]);
-		fprintf(fo, "\n");
+	if (stream_words >= 0) {
+		pthread_create(&reader_pt, NULL, StreamReaderThread, NULL);
+		for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainStreamThread, (void *)a);
 	}
-	fclose(fo);
+	else for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
+	if (model->eval_num > 0) pthread_create(&eval_pt, NULL, EvalModelThread, NULL);
+	for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+	if (stream_words >= 0) pthread_join(reader_pt, NULL);
+	wall_end = WallTime();
+	training_done = 1;
+	if (model->eval_num > 0) {
+		pthread_join(eval_pt, NULL);
+		printf("\nEval: spearman %.4f  final\n", Sem2vecEvaluate(model));
+	}
+	if ((model->debug_mode > 0) && (stream_words >= 0)) {
+		printf("\nRead %lld streamed words of %lld expected in %.2fs\n", stream_read,
+			model->schedule_words, wall_end - wall_start);
+		for (a = 0; a < num_threads; a++)
+			printf("Thread %lld: busy %.2fs  idle %.2fs\n", a, thread_finish[a] - wall_start, wall_end - thread_finish[a]);
+	}
+	else if (model->debug_mode > 0) {
+		if (chunk_cursor > model->iter * num_chunks) chunk_cursor = model->iter * num_chunks;
+		printf("\nTrained %lld chunks (%.2f epochs) in %.2fs\n", chunk_cursor,
+			chunk_cursor / (real)num_chunks, wall_end - wall_start);
+		for (a = 0; a < num_threads; a++)
+			printf("Thread %lld: busy %.2fs  idle %.2fs\n", a, thread_finish[a] - wall_start, wall_end - thread_finish[a]);
+	}
+
+	Sem2vecCompose(model);
+
+	if ((classes == 0) && (output_file[0] != 0)) Sem2vecSaveModel(model, output_file);
+	if (pq_output_file[0] != 0) SaveQuantized(); // normalizes syn0, so it comes last
 	printf("save end\n");
+	free(pt);
 }
 
 // parse arg
@@ -836,6 +624,23 @@ int main(int argc, char **argv) {
 		printf("\t\tThe vocabulary will be read from <file>, not constructed from the training data\n");
 		printf("\t-cbow <int>\n");
 		printf("\t\tUse the continuous bag of words model; default is 1 (use 0 for skip-gram model)\n");
+		printf("\t-eval-sim <file>\n");
+		printf("\t\tScore the vectors on the word pairs in <file> (word1 word2 score) while training\n");
+		printf("\t-eval-interval <float>\n");
+		printf("\t\tSeconds between two evaluations; default is 60\n");
+		printf("\t-early-stop <float>\n");
+		printf("\t\tStop when the score improves by less than <float> in -eval-patience evaluations; default is 0 (off)\n");
+		printf("\t-eval-patience <int>\n");
+		printf("\t\tNumber of evaluations without enough improvement before stopping; default is 2\n");
+		printf("\t-stream <int>\n");
+		printf("\t\tTrain one pass over -train read as a stream (- for stdin, or a pipe), which needs -read-vocab;\n");
+		printf("\t\t<int> is the expected number of words that drives the learning rate, 0 uses the vocabulary counts\n");
+		printf("\t-pq-output <file>\n");
+		printf("\t\tAlso save the normalized word vectors product quantized to <file>, for sem2vec-query -pq\n");
+		printf("\t-pq-m <int>\n");
+		printf("\t\tNumber of one byte codes per quantized vector, must divide -size; default is size / 4\n");
+		printf("\t-incremental <file>\n");
+		printf("\t\tContinue training the model saved in <file> on new data; -read-vocab gives the vocabulary of the new data\n");
 		printf("\nExamples:\n");
 		printf("./word2vec -train data.txt -output vec.txt -size 200 -window 5 -sample 1e-4 -negative 5 -hs 0 -binary 0 -cbow 1 -iter 3\n\n");
 		return 0;
@@ -847,41 +652,53 @@ int main(int argc, char **argv) {
 	read_sense_file[0] = 0;
 	read_semantic_proj[0] = 0; // initialize the file name to NULL
 	checkpoint[0] = 0;
-	if ((i = ArgPos((char *)"-size", argc, argv)) > 0) layer1_size = atoi(argv[i + 1]);
+	incremental_file[0] = 0;
+	eval_file[0] = 0;
+	pq_output_file[0] = 0;
+	model = Sem2vecCreate();
+	if ((i = ArgPos((char *)"-size", argc, argv)) > 0) model->layer1_size = atoi(argv[i + 1]);
 	if ((i = ArgPos((char *)"-train", argc, argv)) > 0) strcpy(train_file, argv[i + 1]);
 	if ((i = ArgPos((char *)"-save-vocab", argc, argv)) > 0) strcpy(save_vocab_file, argv[i + 1]);
 	if ((i = ArgPos((char *)"-read-vocab", argc, argv)) > 0) strcpy(read_vocab_file, argv[i + 1]);
 	if ((i = ArgPos((char *)"-read-meaning", argc, argv)) > 0) strcpy(read_meaning_file, argv[i + 1]);
 	if ((i = ArgPos((char *)"-read-sense", argc, argv)) > 0) strcpy(read_sense_file, argv[i + 1]);
 	if ((i = ArgPos((char *)"-checkpoint", argc, argv)) > 0) strcpy(checkpoint, argv[i + 1]);
-	if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-incremental", argc, argv)) > 0) strcpy(incremental_file, argv[i + 1]);
+	if ((i = ArgPos((char *)"-stream", argc, argv)) > 0) stream_words = atoll(argv[i + 1]);
+	if ((i = ArgPos((char *)"-pq-output", argc, argv)) > 0) strcpy(pq_output_file, argv[i + 1]);
+	if ((i = ArgPos((char *)"-pq-m", argc, argv)) > 0) pq_m = atoll(argv[i + 1]);
+	if ((i = ArgPos((char *)"-eval-sim", argc, argv)) > 0) strcpy(eval_file, argv[i + 1]);
+	if ((i = ArgPos((char *)"-eval-interval", argc, argv)) > 0) eval_interval = atof(argv[i + 1]);
+	if ((i = ArgPos((char *)"-early-stop", argc, argv)) > 0) early_stop = atof(argv[i + 1]);
+	if ((i = ArgPos((char *)"-eval-patience", argc, argv)) > 0) eval_patience = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) model->debug_mode = atoi(argv[i + 1]);
 	if ((i = ArgPos((char *)"-binary", argc, argv)) > 0) binary = atoi(argv[i + 1]);
 	if ((i = ArgPos((char *)"-cbow", argc, argv)) > 0) cbow = atoi(argv[i + 1]);
-	if (cbow) alpha = 0.05;
-	if ((i = ArgPos((char *)"-alpha", argc, argv)) > 0) alpha = atof(argv[i + 1]);
+	if (cbow) model->alpha = 0.05;
+	if ((i = ArgPos((char *)"-alpha", argc, argv)) > 0) model->alpha = atof(argv[i + 1]);
 	if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strcpy(output_file, argv[i + 1]);
-	if ((i = ArgPos((char *)"-window", argc, argv)) > 0) window = atoi(argv[i + 1]);
-	if ((i = ArgPos((char *)"-sample", argc, argv)) > 0) sample = atof(argv[i + 1]);
+	if ((i = ArgPos((char *)"-window", argc, argv)) > 0) model->window = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-sample", argc, argv)) > 0) model->sample = atof(argv[i + 1]);
 	if ((i = ArgPos((char *)"-hs", argc, argv)) > 0) hs = atoi(argv[i + 1]);
-	if ((i = ArgPos((char *)"-negative", argc, argv)) > 0) negative = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-negative", argc, argv)) > 0) model->negative = atoi(argv[i + 1]);
 	if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
-	if ((i = ArgPos((char *)"-iter", argc, argv)) > 0) iter = atoi(argv[i + 1]);
-	if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-iter", argc, argv)) > 0) model->iter = atoi(argv[i + 1]);
+	if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) model->min_count = atoi(argv[i + 1]);
 	if ((i = ArgPos((char *)"-classes", argc, argv)) > 0) classes = atoi(argv[i + 1]);
 	if ((i = ArgPos((char *)"-semantic", argc, argv)) > 0) strcpy(read_semantic_proj, argv[i + 1]); // specify the semantic file
 	if ((i = ArgPos((char *)"-max-list-num", argc, argv)) > 0) MAX_LIST_NUM = atoi(argv[i + 1]);
 	
-	vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
-	
-	vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
-	
-	expTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
-	for (i = 0; i < EXP_TABLE_SIZE; i++) {
-		expTable[i] = exp((i / (real)EXP_TABLE_SIZE * 2 - 1) * MAX_EXP); // Precompute the exp() table
-		expTable[i] = expTable[i] / (expTable[i] + 1);                   // Precompute f(x) = x / (x + 1)
+	if (pq_output_file[0] != 0) { // checked before training, which it would otherwise throw away
+		if (pq_m == 0) pq_m = model->layer1_size / 4;
+		if ((pq_m < 1) || (model->layer1_size % pq_m != 0)) {
+			printf("ERROR: -pq-m %lld (default size / 4) must divide the vector size %lld\n", pq_m, model->layer1_size);
+			exit(1);
+		}
 	}
+	
 	for (i = 0; i < EXP_FROM_ZERO_FORE; ++i)
 		pre_exp[i] = exp((real)i / (real)(EXP_FROM_ZERO_FORE / 4)); // Precompute the exp() table
 	TrainModel();
+	Sem2vecFree(model);
 	return 0;
 }